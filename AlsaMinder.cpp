@@ -1,4 +1,17 @@
 #include "AlsaMinder.hpp"
+#include "SampleFormat.hpp"
+#include <iostream>
+
+// formats we can read, in order of preference when the open command doesn't name one;
+// S16_LE needs no conversion, and the wider ones (carried as S32) are what devices lacking it usually offer
+const snd_pcm_format_t AlsaMinder::FORMATS[] = {
+  SND_PCM_FORMAT_S16_LE,
+  SND_PCM_FORMAT_S24_3LE,
+  SND_PCM_FORMAT_S24_LE,
+  SND_PCM_FORMAT_S32_LE,
+  SND_PCM_FORMAT_FLOAT_LE
+};
+const int AlsaMinder::NUM_FORMATS = sizeof(AlsaMinder::FORMATS) / sizeof(AlsaMinder::FORMATS[0]);
 
 void AlsaMinder::delete_privates() {
   if (pcm) {
@@ -17,6 +30,8 @@ int AlsaMinder::hw_open() {
   snd_pcm_access_mask_t *mask;
   snd_pcm_uframes_t boundary;
 
+  peekUnsupported = false;
+
   snd_pcm_hw_params_alloca( & params);
   snd_pcm_sw_params_alloca( & swparams);
   snd_pcm_access_mask_alloca( & mask );
@@ -29,12 +44,46 @@ int AlsaMinder::hw_open() {
   if ((snd_pcm_open(& pcm, devName.c_str(), SND_PCM_STREAM_CAPTURE, 0))
       || snd_pcm_hw_params_any(pcm, params)
       || snd_pcm_hw_params_set_access_mask(pcm, params, mask)
-      || snd_pcm_hw_params_set_format(pcm, params, SND_PCM_FORMAT_S16_LE)
+      ) {
+    return 1;
+  }
+
+  // use the requested sample format, or the first in FORMATS the device offers
+  format = SND_PCM_FORMAT_UNKNOWN;
+  for (int i = 0; i < NUM_FORMATS; ++i) {
+    if (reqFormat.length() > 0 ? reqFormat == snd_pcm_format_name(FORMATS[i]) : ! snd_pcm_hw_params_test_format(pcm, params, FORMATS[i])) {
+      format = FORMATS[i];
+      break;
+    }
+  }
+  if (format == SND_PCM_FORMAT_UNKNOWN) {
+    std::cerr << about() << ": no usable sample format" << std::endl;
+    return 1;
+  }
+  setFormat(format);
+
+  if (snd_pcm_hw_params_set_format(pcm, params, format)
       || snd_pcm_hw_params_set_channels(pcm, params, numChan)
       || snd_pcm_hw_params_set_rate_resample(pcm, params, 0)
       || snd_pcm_hw_params_set_rate_last(pcm, params, & hwRate, & rateDir)
       || hwRate % rate != 0 // we only do exact rate decimation
-      || snd_pcm_hw_params_set_period_size_near(pcm, params, & period_frames, 0) < 0
+      ) {
+    return 1;
+  }
+
+  // Period and buffer sizes, in hardware frames.  ALSA picks the nearest
+  // sizes the hardware allows; the buffer needs at least two periods.
+  if (reqPeriodFrames > 0)
+    period_frames = reqPeriodFrames;
+  else if (reqWakeups > 0)
+    period_frames = std::max(1L, lround(hwRate / reqWakeups));
+  else
+    period_frames = PERIOD_FRAMES;
+  buffer_frames = reqBufferFrames > 0 ? reqBufferFrames : BUFFER_FRAMES;
+  if (buffer_frames < 2 * period_frames)
+    buffer_frames = 2 * period_frames;
+
+  if (snd_pcm_hw_params_set_period_size_near(pcm, params, & period_frames, 0) < 0
       || snd_pcm_hw_params_set_buffer_size_near(pcm, params, & buffer_frames) < 0
       || snd_pcm_hw_params(pcm, params)
       || snd_pcm_sw_params_current(pcm, swparams)
@@ -42,7 +91,8 @@ int AlsaMinder::hw_open() {
 #ifdef RPI
       || snd_pcm_sw_params_set_tstamp_type(pcm, swparams, SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY)
 #endif
-      || snd_pcm_sw_params_set_period_event(pcm, swparams, 1)
+      // a SweepTimer reading the device doesn't need it to wake us each period
+      || snd_pcm_sw_params_set_period_event(pcm, swparams, (useSweepTimer && ! useCaptureThreads) ? 0 : 1)
       // get the ring buffer boundary, and
       || snd_pcm_sw_params_get_boundary	(swparams, &boundary)
       || snd_pcm_sw_params_set_stop_threshold (pcm, swparams, boundary)
@@ -55,19 +105,34 @@ int AlsaMinder::hw_open() {
   return 0;
 };
 
+const char * AlsaMinder::hw_formatName() {
+  return snd_pcm_format_name(format);
+};
+
+int AlsaMinder::hw_periodFrames() {
+  return period_frames;
+};
+
+int AlsaMinder::hw_bufferFrames() {
+  return buffer_frames;
+};
+
 bool AlsaMinder::hw_is_open() {
   return pcm != 0;
 };
 
 int AlsaMinder::hw_do_stop() {
-  if (pcm) {
+  // keep the handle and its negotiated parameters, so a later start
+  // needs only prepare and start
+  if (pcm)
     snd_pcm_drop(pcm);
-    snd_pcm_close(pcm);
-    pcm = 0;
-  }
   return 0;
 };
 
+void AlsaMinder::hw_close() {
+  delete_privates();
+};
+
 bool AlsaMinder::hw_running(double timeNow) {
   return pcm && snd_pcm_state(pcm) == SND_PCM_STATE_RUNNING;
 };
@@ -75,12 +140,15 @@ bool AlsaMinder::hw_running(double timeNow) {
 int AlsaMinder::hw_do_start() {
   if (!pcm && open())
     return 1;
-  snd_pcm_prepare(pcm);
-  hasError = snd_pcm_start(pcm);
-  return 0;
+  clock.reset(hwRate);
+  hasError = snd_pcm_prepare(pcm);
+  if (! hasError)
+    hasError = snd_pcm_start(pcm);
+  return hasError ? 1 : 0;
 }
 
 int AlsaMinder::hw_do_restart() {
+  clock.reset(hwRate);
   snd_pcm_recover(pcm, hasError, 1);
   snd_pcm_prepare(pcm);
   snd_pcm_start(pcm);
@@ -92,11 +160,19 @@ AlsaMinder::AlsaMinder(const string &devName, int rate, unsigned int numChan, co
   revents(0),
   pcm(0),
   buffer_frames(BUFFER_FRAMES),
-  period_frames(PERIOD_FRAMES)
+  period_frames(PERIOD_FRAMES),
+  peekOffset(0),
+  peekFrames(0),
+  peekUnsupported(false),
+  format(SND_PCM_FORMAT_S16_LE),
+  copier(0),
+  wideCopier(0)
 {
+  setFormat(format);
 };
 
 AlsaMinder::~AlsaMinder() {
+  stopCaptureThread(); // must not be reading hardware while it is closed
   delete_privates();
 };
 
@@ -127,22 +203,188 @@ int AlsaMinder::hw_handleEvents ( struct pollfd *pollfds, bool timedOut) {
   } else {
     revents = 0;
   }
-  if (revents & (POLLIN | POLLPRI)) {
-    // return number of frames available
-    snd_pcm_sframes_t avail = snd_pcm_avail_update (pcm);
-    return avail;
-  }
+  if (revents & (POLLIN | POLLPRI))
+    return hw_availNow();
   return 0;
 };
 
+int AlsaMinder::hw_availNow() {
+  // return number of frames available
+  if (!pcm)
+    return 0;
+  snd_pcm_sframes_t avail = snd_pcm_avail_update (pcm);
+  if (avail == -EPIPE) {
+    // overrun with the stream stopped; the caller restarts it, and
+    // we don't know how many frames were lost
+    noteOverrun(0, false);
+  } else if (avail > (snd_pcm_sframes_t) buffer_frames) {
+    // The stop threshold is the ring boundary, so an overrun doesn't
+    // stop the stream: the hardware has just overwritten frames we
+    // hadn't read.  Skip those, plus a period, since the oldest
+    // remaining frames are about to be overwritten too.
+    snd_pcm_sframes_t skipped = snd_pcm_forward (pcm, avail - buffer_frames + period_frames);
+    if (skipped > 0) {
+      noteOverrun(skipped, false);
+      frameIndex += skipped;
+      avail = snd_pcm_avail_update (pcm);
+    }
+  }
+  return avail;
+};
+
+double AlsaMinder::timestampNextFrame() {
+  // Every so often, get the most recent period timestamp from ALSA;
+  // frame timestamps come from the estimator those feed.
+  if (clock.wantObservation(frameIndex)) {
+    snd_htimestamp_t ts;
+    snd_pcm_uframes_t av;
+    snd_pcm_htimestamp(pcm, &av, &ts);
+    double observed = ts.tv_sec + (double) ts.tv_nsec / 1.0e9 - (double) av / hwRate;
+
+    // frames lost without the fill level showing it (e.g. dropped by the
+    // USB driver) show up as a timestamp later than estimated.  NB: so
+    // would a step in the system clock, for timestamp types which follow it.
+    if (clock.ready()) {
+      double gap = clock.residualOf(frameIndex, observed);
+      if (gap * hwRate > TIMELINE_GAP_PERIODS * period_frames) {
+        long long lost = (long long) (gap * hwRate + 0.5);
+        noteOverrun(lost, true);
+        frameIndex += lost;
+      }
+    }
+    clock.addObservation(frameIndex, observed);
+  }
+  return clock.timestampOf(frameIndex);
+};
+
+int AlsaMinder::commitFrames(snd_pcm_uframes_t offset, snd_pcm_uframes_t frames) {
+  // no messages here: this can run on a capture thread
+  snd_pcm_sframes_t errcode = snd_pcm_mmap_commit (pcm, offset, frames);
+  return errcode < 0 ? errcode : 0;
+};
+
 int AlsaMinder::hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp) {
-  // get most recent period timestamp from ALSA
-  snd_htimestamp_t ts;
-  snd_pcm_uframes_t av;
-  snd_pcm_htimestamp(pcm, &av, &ts);
-  frameTimestamp = ts.tv_sec + (double) ts.tv_nsec / 1.0e9 - (double) av / hwRate;
+  return getFramesVia(copier, buf, numFrames, frameTimestamp);
+};
+
+int AlsaMinder::hw_getWideFrames (int32_t *buf, int numFrames, double & frameTimestamp) {
+  return getFramesVia(wideCopier, buf, numFrames, frameTimestamp);
+};
+
+template < class T, class C >
+int AlsaMinder::getFramesVia(C copy, T *buf, int numFrames, double & frameTimestamp) {
+  frameTimestamp = timestampNextFrame();
+
+  // snd_pcm_mmap_begin only hands out frames up to the end of the ring,
+  // so keep going until we have all numFrames; that way frames past the
+  // wrap point go out in the same block rather than waiting for another
+  // wakeup.
+
+  int got = 0;
+  int segments = 0;
+  while (got < numFrames) {
+    // begin direct access to ALSA mmap buffers for the device
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t have = (snd_pcm_uframes_t) (numFrames - got);
+
+    int errcode = snd_pcm_mmap_begin (pcm, & areas, & offset, & have);
+    if (errcode) {
+      if (got > 0)
+        break; // deliver what we have; the error will recur next time
+      return errcode > 0 ? -errcode : errcode;
+    }
+    if (have == 0)
+      break;
+
+    (this->*copy)(areas, offset, have, buf);
+    buf += have * numChan;
+    got += have;
+    ++segments;
+    frameIndex += have;
+    errcode = commitFrames(offset, have);
+    if (errcode)
+      return errcode; // the caller reports it and restarts the device
+  }
+  if (segments > 1)
+    wrappedReads.add();
+  return got;
+};
+
+void AlsaMinder::addStatsFields(std::ostream & s) {
+  DevMinder::addStatsFields(s);
+  s << ",\"wrappedReads\":" << wrappedReads.get();
+};
+
+template < class Sample, int N >
+void AlsaMinder::copyFramesAs(const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t have, typename Sample::Type *buf) {
+  /*
+    convert available samples to Sample::Type in buf, interleaving
+    channels in order; N is the number of channels, or 0 for numChan.
+    With N fixed, the channel loop is unrolled.
+  */
+
+  const unsigned chans = N ? N : numChan;
+  const unsigned char *src[MAX_CHANNELS];
+  int step[MAX_CHANNELS];  // in bytes
+
+  for (unsigned c = 0; c < chans; ++c) {
+    step[c] = areas[c].step / 8;
+    src[c] = ((const unsigned char *) areas[c].addr) + areas[c].first / 8 + step[c] * offset;
+  }
+  for (unsigned i=0; i < have; ++i) {
+    for (unsigned c = 0; c < chans; ++c) {
+      *buf++ = Sample::convert(src[c]);
+      src[c] += step[c];
+    }
+  }
+};
+
+template < class Sample, class C >
+C AlsaMinder::copierForChannels(unsigned numChan) {
+  switch (numChan) {
+  case 1:
+    return & AlsaMinder::copyFramesAs < Sample, 1 >;
+  case 2:
+    return & AlsaMinder::copyFramesAs < Sample, 2 >;
+  case 4:
+    return & AlsaMinder::copyFramesAs < Sample, 4 >;
+  case 8:
+    return & AlsaMinder::copyFramesAs < Sample, 8 >;
+  default:
+    return & AlsaMinder::copyFramesAs < Sample, 0 >;
+  }
+};
+
+void AlsaMinder::setFormat(snd_pcm_format_t format) {
+  // S16_LE is carried as it is; the wider formats are carried as S32,
+  // so none of their dynamic range is lost
+  this->format = format;
+  wide = format != SND_PCM_FORMAT_S16_LE;
+  maxSampleAbs = wide ? WIDE_MAX_SAMPLE_ABS : 32768;
+  switch (format) {
+  case SND_PCM_FORMAT_S24_3LE:
+    wideCopier = copierForChannels < SampleFormat::S24_3, WideCopier > (numChan);
+    break;
+  case SND_PCM_FORMAT_S24_LE:
+    wideCopier = copierForChannels < SampleFormat::S24, WideCopier > (numChan);
+    break;
+  case SND_PCM_FORMAT_S32_LE:
+    wideCopier = copierForChannels < SampleFormat::S32, WideCopier > (numChan);
+    break;
+  case SND_PCM_FORMAT_FLOAT_LE:
+    wideCopier = copierForChannels < SampleFormat::FLOAT, WideCopier > (numChan);
+    break;
+  default:
+    copier = copierForChannels < SampleFormat::S16, Copier > (numChan);
+    break;
+  }
+};
+
+int AlsaMinder::hw_peekFrames (const int16_t * & frames, int numFrames, double & frameTimestamp) {
+  if (peekUnsupported || format != SND_PCM_FORMAT_S16_LE)
+    return -ENOSYS;
 
-  // begin direct access to ALSA mmap buffers for the device
   const snd_pcm_channel_area_t *areas;
   snd_pcm_uframes_t offset;
   snd_pcm_uframes_t have = (snd_pcm_sframes_t) numFrames;
@@ -151,38 +393,39 @@ int AlsaMinder::hw_getFrames (int16_t *buf, int numFrames, double & frameTimesta
   if (errcode)
     return errcode > 0 ? -errcode : errcode;
 
-  int16_t *src0, *src1=0; // avoid compiler warning
-  int step;
+  // the frames can be used in place only if they're already packed
+  // S16_LE frames, with channels interleaved in order
 
-  /*
-    copy available samples to buf
-  */
+  const unsigned char * base = (const unsigned char *) areas[0].addr;
+  bool packed = areas[0].step == 16 * numChan;
+  for (unsigned c = 0; c < numChan && packed; ++c)
+    packed = areas[c].addr == areas[0].addr && areas[c].first == areas[0].first + 16 * c && areas[c].step == areas[0].step;
+  if (! packed) {
+    // hand the frames straight back; the caller will use hw_getFrames, now and from now on
+    commitFrames(offset, 0);
+    peekUnsupported = true;
+    return -ENOSYS;
+  }
 
-  // FIXME: assumes interleaved channels
-  src0 = (int16_t *) (((unsigned char *) areas[0].addr) + areas[0].first / 8);
-  step = areas[0].step / 16; // FIXME:  hardcoding S16_LE assumption
-  src0 += step * offset;
-
-  if (numChan == 2) {
-    src1 = (int16_t *) (((unsigned char *) areas[1].addr) + areas[1].first / 8);
-    src1 += step * offset;
-    for (unsigned i=0; i < have * numChan; ++i) {
-      *buf++ = *src0;
-      *buf++ = *src1;
-      src0 += step;
-      src1 += step;
-    }
-  } else {
-    for (unsigned i=0; i < have * numChan; ++i) {
-      *buf++ = *src0;
-      src0 += step;
+  frameTimestamp = timestampNextFrame();
+  frames = (const int16_t *) (base + areas[0].first / 8) + offset * numChan;
+  peekOffset = offset;
+  peekFrames = have;
+  frameIndex += have;
+  return (have);
+};
+
+void AlsaMinder::hw_releaseFrames () {
+  if (peekFrames) {
+    int errcode = commitFrames(peekOffset, peekFrames);
+    peekFrames = 0;
+    if (errcode) {
+      // peeking is only done on the main thread
+      std::ostringstream msg;
+      msg << "\"event\":\"devProblem\",\"error\":\" snd_pcm_mmap_commit returned with error " << (-errcode) << "\",\"devLabel\":\"" << label << "\"";
+      Pollable::asyncMsg(msg.str());
     }
   }
-  errcode = snd_pcm_mmap_commit (pcm, offset, have);
-  if (errcode < 0) {
-    std::ostringstream msg;
-    msg << "\"event\":\"devProblem\",\"error\":\" snd_pcm_mmap_commit returned with error " << (-errcode) << "\",\"devLabel\":\"" << label << "\"";
-    Pollable::asyncMsg(msg.str());
-  }
-  return (have);
 };
+
+const double AlsaMinder::TIMELINE_GAP_PERIODS = 0.5;
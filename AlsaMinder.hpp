@@ -16,8 +16,11 @@ using namespace std;
 class AlsaMinder : public DevMinder {
 public:
 
-  static const int  PERIOD_FRAMES         = 4800;   // 40 periods per second for FCD Pro +; 20 periods per second for FCD Pro
+  static const int  PERIOD_FRAMES         = 4800;   // defaults, unless given at open: 40 periods per second for FCD Pro +; 20 periods per second for FCD Pro
   static const int  BUFFER_FRAMES         = 131072; // 128K appears to be max buffer size in frames; this is 0.683 s for FCD Pro+, 1.365 s for FCD Pro
+  static const snd_pcm_format_t FORMATS[]; // sample formats we can read, in order of preference
+  static const int NUM_FORMATS;
+  static const double TIMELINE_GAP_PERIODS; // hardware timestamps later than estimated by more than this many periods mean lost frames
 
 protected:
 
@@ -29,6 +32,18 @@ protected:
                                       // it)
   snd_pcm_uframes_t period_frames;    // period size given to us by ALSA (we attempt to specify
                                       // it)
+  snd_pcm_uframes_t peekOffset;       // mmap offset of frames handed out by hw_peekFrames
+  snd_pcm_uframes_t peekFrames;       // number of those frames; 0 means none outstanding
+  bool              peekUnsupported;  // the mmap layout isn't packed interleaved frames, so hw_peekFrames can't be used
+  StatCounter       wrappedReads;     // hw_getFrames calls which crossed the end of the mmap ring
+
+  // convert frames from one mmap segment to interleaved S16 or S32 in buf
+  typedef void (AlsaMinder::*Copier) (const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t have, int16_t *buf);
+  typedef void (AlsaMinder::*WideCopier) (const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t have, int32_t *buf);
+
+  snd_pcm_format_t  format;           // sample format negotiated with the device
+  Copier            copier;           // copyFramesAs specialized for numChan, if format is S16_LE
+  WideCopier        wideCopier;       // copyFramesAs specialized for format and numChan, for the wider formats
 public:
 
   virtual int hw_open();
@@ -45,15 +60,43 @@ public:
 
   virtual int hw_handleEvents ( struct pollfd *pollfds, bool timedOut);
 
+  virtual bool hw_sweepable () {return true;};
+
+  virtual int hw_availNow ();
+
   virtual int hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp);
 
+  virtual int hw_getWideFrames (int32_t *buf, int numFrames, double & frameTimestamp);
+
+  virtual int hw_peekFrames (const int16_t * & frames, int numFrames, double & frameTimestamp);
+
+  virtual void hw_releaseFrames ();
+
+  virtual const char * hw_formatName ();
+
+  virtual int hw_periodFrames ();
+
+  virtual int hw_bufferFrames ();
+
 protected:
 
   virtual void delete_privates();
   virtual int hw_do_start();
   virtual int hw_do_stop();
+  virtual void hw_close();
   virtual int hw_do_restart();
   virtual bool hw_running(double timeNow);
+
+  double timestampNextFrame();        // estimated timestamp of frame frameIndex, taking a hardware timestamp if one is due
+  int commitFrames(snd_pcm_uframes_t offset, snd_pcm_uframes_t frames); // hand frames back to ALSA; returns 0 or a negative error code
+  template < class Sample, int N >
+  void copyFramesAs(const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t have, typename Sample::Type *buf); // a (Wide)Copier for one of the SampleFormat classes and N channels (0 means numChan)
+  template < class Sample, class C >
+  static C copierForChannels(unsigned numChan);
+  void setFormat(snd_pcm_format_t format); // choose the copier, sample width, and scale for format
+  template < class T, class C >
+  int getFramesVia(C copy, T *buf, int numFrames, double & frameTimestamp); // hw_getFrames or hw_getWideFrames, copying with copy
+  virtual void addStatsFields(std::ostream & s);
 };
 
 #endif // ALSAMINDER_HPP
@@ -0,0 +1,61 @@
+#include "ChannelMinder.hpp"
+#include <stdlib.h>
+#include <iostream>
+
+ChannelMinder::ChannelMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now):
+  DevMinder(devName, rate, numChan, 32767, label, now, 1),
+  numChannels(0),
+  channel(-1)
+{
+  // parse from the right, as the parent's label might contain ':'
+  size_t c2 = devName.rfind(':');
+  size_t c1 = c2 == string::npos || c2 == 0 ? string::npos : devName.rfind(':', c2 - 1);
+  if (devName.substr(0, 5) != "chan:" || c1 == string::npos || c1 < 5)
+    throw std::runtime_error("Invalid name for channel device; must look like 'chan:DEV_LABEL:N:K'");
+  parentLabel = devName.substr(5, c1 - 5);
+  numChannels = atoi(devName.c_str() + c1 + 1);
+  channel = atoi(devName.c_str() + c2 + 1);
+};
+
+DevMinder * ChannelMinder::parent() {
+  return dynamic_cast < DevMinder * > (Pollable::lookupByName(parentLabel));
+};
+
+int ChannelMinder::hw_open() {
+  DevMinder * p = parent();
+  if (! p) {
+    std::cerr << "there is no device with label '" << parentLabel << "'\n";
+    return 1;
+  }
+  if (numChan != 2) {
+    std::cerr << "channel devices have 2 (I/Q) channels\n";
+    return 2;
+  }
+  if (reqPeriodFrames > 0 || reqWakeups > 0 || reqBufferFrames > 0 || reqFormat.length() > 0) {
+    // frames arrive whenever the parent device processes a block
+    std::cerr << "channel devices don't accept a period, wakeup rate, buffer size, or format\n";
+    return 3;
+  }
+  if (numChannels <= 0 || p->hwRate % numChannels != 0) {
+    std::cerr << "device " << parentLabel << "'s rate isn't a multiple of " << numChannels << "\n";
+    return 4;
+  }
+  hwRate = p->hwRate / numChannels;
+  if (rate <= 0 || hwRate % rate != 0) { // we only do exact rate decimation
+    std::cerr << "channel rate " << hwRate << " is not a multiple of " << rate << "\n";
+    return 5;
+  }
+  maxSampleAbs = p->maxSampleAbs;
+  wide = p->wide; // channels have the parent's sample width
+  return p->addChannelDev(numChannels, channel, label) ? 6 : 0;
+};
+
+bool ChannelMinder::hw_is_open() {
+  return parent() != 0;
+};
+
+int ChannelMinder::hw_do_start() {
+  // re-register, in case the parent was closed and reopened since
+  DevMinder * p = parent();
+  return p && ! p->addChannelDev(numChannels, channel, label) ? 0 : 1;
+};
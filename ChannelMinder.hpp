@@ -0,0 +1,61 @@
+#ifndef CHANNELMINDER_HPP
+#define CHANNELMINDER_HPP
+
+#include <string>
+#include <stdexcept>
+#include <sstream>
+
+using namespace std;
+
+#include "DevMinder.hpp"
+
+/*
+  A virtual device carrying one narrow channel of another (I/Q) device,
+  as split out by that device's Channelizer.  The device name looks like
+  'chan:DEV_LABEL:N:K', for channel K of N from the device opened as
+  DEV_LABEL.  Its hardware rate is that device's divided by N.
+
+  It has no hardware of its own: frames arrive whenever the parent
+  device processes a block, and only while this device is started.
+  Plugins and raw listeners attach to it as to any other device.
+*/
+
+class ChannelMinder : public DevMinder {
+
+protected:
+
+  std::string            parentLabel; // label of device this channel is split from
+  int                    numChannels; // number of channels parent is split into
+  int                    channel;     // which of those this device carries
+
+public:
+
+  virtual int hw_open();
+
+  virtual bool hw_is_open();
+
+  ChannelMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now);
+
+  virtual int hw_getNumPollFDs () {return 0;};
+
+  virtual int hw_getPollFDs (struct pollfd *pollfds) {return 0;};
+
+  virtual int hw_handleEvents ( struct pollfd *pollfds, bool timedOut) {return 0;};
+
+  virtual int hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp) {return 0;};
+
+  virtual bool hw_threadable () {return false;}; // no fds for a thread to wait on
+
+  virtual const char * hw_formatName () {return wide ? "S32_LE" : "S16_LE";}; // as the parent's channelizer delivers them
+
+protected:
+
+  virtual int hw_do_start();
+  virtual int hw_do_stop() {return 0;};
+  virtual int hw_do_restart() {return 0;};
+  virtual bool hw_running(double timeNow) {return false;}; // so start always marks this device as running
+
+  DevMinder * parent();               // the device this channel is split from; 0 if it has been closed
+};
+
+#endif // CHANNELMINDER_HPP
@@ -0,0 +1,164 @@
+#include "Channelizer.hpp"
+#include "DownSampler.hpp"
+#include <math.h>
+#include <string.h>
+#include <stdexcept>
+#include <limits>
+
+Channelizer::Channelizer(int numChannels) :
+  m(numChannels),
+  len(numChannels * TAPS_PER_PHASE),
+  phase(numChannels),
+  firstOffset(0),
+  acc(2 * numChannels),
+  fftIn(0),
+  spectra(0),
+  spectraFrames(0),
+  outFrames(0),
+  plan(0)
+{
+  if (m < 2 || m > MAX_CHANNELS || (m & (m - 1)))
+    throw std::runtime_error("number of channels must be a power of two from 2 to 1024");
+  designTaps();
+  hist.assign(2 * (len - 1), 0.0f);
+
+  // plan on the first output frame's slot; other frames' slots have
+  // the same alignment, as each is m complex values from the last
+  fftIn = (fftwf_complex *) fftwf_malloc(m * sizeof(fftwf_complex));
+  spectraFrames = 64;
+  spectra = (fftwf_complex *) fftwf_malloc(spectraFrames * m * sizeof(fftwf_complex));
+  plan = fftwf_plan_dft_1d(m, fftIn, spectra, FFTW_BACKWARD, FFTW_ESTIMATE);
+};
+
+Channelizer::~Channelizer() {
+  if (plan)
+    fftwf_destroy_plan(plan);
+  fftwf_free(fftIn);
+  fftwf_free(spectra);
+};
+
+void
+Channelizer::designTaps() {
+  // Kaiser-windowed sinc lowpass with cutoff at the channel edge,
+  // half the channel spacing, and unity DC gain.  Tap l of the
+  // prototype meets the input frame l frames before the newest one.
+  // Channel k mixes its band down to DC and filters:
+  //
+  //    y_k = sum_l h[l] x[e - l] exp(-2 pi i k (e - l) / m)
+  //
+  // and when outputs are taken every m frames, the factor exp(-2 pi i k e / m)
+  // is the same for every output of a channel, so it's dropped.
+  // Writing l = t m + p, y_k = sum_p exp(2 pi i k p / m) u_p, an inverse
+  // DFT of u_p = sum_t h[t m + p] x[e - t m - p].
+
+  const double beta = 7.0;
+  const double cutoff = 0.5 / m;
+  double centre = (len - 1) / 2.0;
+  std::vector < double > h(len);
+  double sum = 0;
+  for (int l = 0; l < len; ++l) {
+    double x = 2 * cutoff * (l - centre);
+    double r = 2 * (l - centre) / (len - 1);
+    h[l] = (x == 0 ? 1 : sin(M_PI * x) / (M_PI * x)) * DownSampler::besselI0(beta * sqrt(1 - r * r)) / DownSampler::besselI0(beta);
+    sum += h[l];
+  }
+
+  // for phase t, the input frames x[e - t m - p] for p = m-1 ... 0 are
+  // contiguous and oldest first; store h[t m + p] in that order
+  taps.resize(2 * len);
+  for (int t = 0; t < TAPS_PER_PHASE; ++t) {
+    for (int q = 0; q < m; ++q) {
+      float v = h[t * m + m - 1 - q] / sum;
+      taps[2 * (t * m + q)] = taps[2 * (t * m + q) + 1] = v;
+    }
+  }
+};
+
+int
+Channelizer::process(const int16_t *iq, int frames) {
+  return processAs(iq, frames);
+};
+
+int
+Channelizer::process(const int32_t *iq, int frames) {
+  return processAs(iq, frames);
+};
+
+template < typename T >
+int
+Channelizer::processAs(const T *iq, int frames) {
+  // append the block to the history
+  int have = len - 1;
+  hist.resize(2 * (have + frames));
+  float * h = & hist[2 * have];
+  for (int i = 0; i < 2 * frames; ++i)
+    h[i] = iq[i];
+
+  // there's an output frame whenever the newest frame is the last of m
+  int first = phase - 1;
+  outFrames = first < frames ? (frames - first - 1) / m + 1 : 0;
+  firstOffset = first;
+  if (outFrames > spectraFrames) {
+    fftwf_free(spectra);
+    spectraFrames = outFrames;
+    spectra = (fftwf_complex *) fftwf_malloc(spectraFrames * m * sizeof(fftwf_complex));
+  }
+
+  const int n2 = 2 * m;
+  float * a = & acc[0];
+  for (int n = 0; n < outFrames; ++n) {
+    // newest frame of this output, as an index into hist
+    int e = have + first + n * m;
+    memset(a, 0, n2 * sizeof(float));
+    for (int t = 0; t < TAPS_PER_PHASE; ++t) {
+      const float * x = & hist[2 * (e - (t + 1) * m + 1)];
+      const float * g = & taps[t * n2];
+      for (int j = 0; j < n2; ++j)
+        a[j] += g[j] * x[j];
+    }
+    // acc holds u_p in reverse order of p
+    for (int p = 0; p < m; ++p) {
+      fftIn[p][0] = a[2 * (m - 1 - p)];
+      fftIn[p][1] = a[2 * (m - 1 - p) + 1];
+    }
+    fftwf_execute_dft(plan, fftIn, spectra + n * m);
+  }
+
+  phase = first < frames ? m - (frames - first - 1) % m : phase - frames;
+
+  // keep only what the next block's outputs need
+  memmove(& hist[0], & hist[2 * frames], 2 * have * sizeof(float));
+  hist.resize(2 * have);
+  return outFrames;
+};
+
+// round v to the nearest T, saturating; compared as floats, so for int32_t the limits are +-2^31
+template < typename T >
+static inline T
+roundSat(float v) {
+  v = roundf(v);
+  if (v >= (float) std::numeric_limits < T >::max())
+    return std::numeric_limits < T >::max();
+  if (v <= (float) std::numeric_limits < T >::min())
+    return std::numeric_limits < T >::min();
+  return (T) v;
+};
+
+void
+Channelizer::getChannel(int k, int16_t *out) {
+  getChannelAs(k, out);
+};
+
+void
+Channelizer::getChannel(int k, int32_t *out) {
+  getChannelAs(k, out);
+};
+
+template < typename T >
+void
+Channelizer::getChannelAs(int k, T *out) {
+  for (int n = 0; n < outFrames; ++n) {
+    out[2 * n]     = roundSat < T > (spectra[n * m + k][0]);
+    out[2 * n + 1] = roundSat < T > (spectra[n * m + k][1]);
+  }
+};
@@ -0,0 +1,67 @@
+#ifndef CHANNELIZER_HPP
+#define CHANNELIZER_HPP
+
+/*
+  Polyphase filter bank channelizer: splits a stream of interleaved
+  S16 or S32 I/Q frames into numChannels narrow complex channels, each
+  decimated by numChannels.
+
+  Channel k is centred k / numChannels of the input rate above the
+  centre of the input band; channels k >= numChannels / 2 are those
+  below it (i.e. at k - numChannels).  Each channel's passband is
+  the channel spacing wide, with a Kaiser-windowed prototype filter of
+  TAPS_PER_PHASE taps per channel.
+
+  Each output frame costs one multiply-add per tap for the filter and
+  one numChannels-point FFT, shared by all channels, so the cost per
+  input frame grows as log(numChannels) rather than numChannels.
+
+  State is carried across calls, so a stream can be fed in blocks of
+  any size.  Output is kept only for the current block.
+*/
+
+#include <stdint.h>
+#include <vector>
+#include <fftw3.h>
+
+class Channelizer {
+
+public:
+  static const int  TAPS_PER_PHASE = 16;    // prototype filter length is this times numChannels
+  static const int  MAX_CHANNELS = 1024;    // maximum numChannels
+
+  Channelizer(int numChannels);           // numChannels must be a power of two from 2 to MAX_CHANNELS
+  ~Channelizer();
+
+  int process(const int16_t *iq, int frames); // channelize a block of frames; returns number of output frames per channel
+  int process(const int32_t *iq, int frames); // the same, for S32 frames
+  void getChannel(int k, int16_t *out);   // copy channel k's output for the current block as interleaved S16 I/Q
+  void getChannel(int k, int32_t *out);   // the same, as S32 I/Q
+  int firstOutputOffset() {return firstOffset;}; // index in the current block of input frame aligned with first output frame
+  double delayFrames() {return (len - 1) / 2.0;}; // filter delay, in input frames
+
+  int numChannels() {return m;};
+
+protected:
+  int                   m;              // number of channels, and decimation factor
+  int                   len;            // prototype filter length
+  std::vector < float > taps;           // for each phase t, m taps per complex sample, each stored twice (for I and Q), in the
+                                        // order they meet the input; so each phase is a contiguous dot product
+  std::vector < float > hist;           // input as interleaved float I/Q: the len - 1 frames before the current block, then the block
+  int                   phase;          // input frames remaining until next output frame
+  int                   firstOffset;    // see firstOutputOffset()
+  std::vector < float > acc;            // filter outputs for one output frame, in reverse order of phase
+  fftwf_complex *       fftIn;          // FFT input, one output frame's worth
+  fftwf_complex *       spectra;        // FFT outputs for the current block, m per output frame
+  int                   spectraFrames;  // capacity of spectra, in output frames
+  int                   outFrames;      // output frames in spectra for the current block
+  fftwf_plan            plan;           // inverse FFT from fftIn to start of spectra; executed on other output frames with fftwf_execute_dft
+
+  void designTaps();
+  template < typename T >
+  int processAs(const T *iq, int frames); // either process
+  template < typename T >
+  void getChannelAs(int k, T *out);     // either getChannel
+};
+
+#endif // CHANNELIZER_HPP
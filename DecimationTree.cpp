@@ -0,0 +1,287 @@
+#include "DecimationTree.hpp"
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DECIMATIONTREE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DECIMATIONTREE_SSE2
+#endif
+
+/*
+  convert n frames of interleaved mono or stereo int16 samples to
+  float, multiplying by scale and writing each channel to its own
+  buffer.
+*/
+
+static void
+toFloat1(const int16_t *p, int n, float scale, float *d0) {
+  int i = 0;
+#if defined(DECIMATIONTREE_NEON)
+  for (; i + 8 <= n; i += 8, p += 8) {
+    int16x8_t x = vld1q_s16(p);
+    vst1q_f32(d0 + i,     vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+    vst1q_f32(d0 + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
+  }
+#elif defined(DECIMATIONTREE_SSE2)
+  const __m128 s = _mm_set1_ps(scale);
+  for (; i + 8 <= n; i += 8, p += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *) p);
+    // sign-extend by unpacking each sample into the high half of a lane
+    _mm_storeu_ps(d0 + i,     _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), s));
+    _mm_storeu_ps(d0 + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)), s));
+  }
+#endif
+  for (; i < n; ++i)
+    d0[i] = *p++ * scale;
+};
+
+static void
+toFloat2(const int16_t *p, int n, float scale, float *d0, float *d1) {
+  int i = 0;
+#if defined(DECIMATIONTREE_NEON)
+  for (; i + 8 <= n; i += 8, p += 16) {
+    int16x8x2_t x = vld2q_s16(p); // deinterleave 8 frames
+    vst1q_f32(d0 + i,     vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x.val[0]))), scale));
+    vst1q_f32(d0 + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x.val[0]))), scale));
+    vst1q_f32(d1 + i,     vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x.val[1]))), scale));
+    vst1q_f32(d1 + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x.val[1]))), scale));
+  }
+#elif defined(DECIMATIONTREE_SSE2)
+  const __m128 s = _mm_set1_ps(scale);
+  for (; i + 4 <= n; i += 4, p += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *) p);
+    __m128 a = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)); // L0 R0 L1 R1
+    __m128 b = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)); // L2 R2 L3 R3
+    _mm_storeu_ps(d0 + i, _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), s));
+    _mm_storeu_ps(d1 + i, _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), s));
+  }
+#endif
+  for (; i < n; ++i) {
+    d0[i] = *p++ * scale;
+    d1[i] = *p++ * scale;
+  }
+};
+
+/*
+  the same for S32 samples
+*/
+
+static void
+toFloat1(const int32_t *p, int n, float scale, float *d0) {
+  int i = 0;
+#if defined(DECIMATIONTREE_NEON)
+  for (; i + 4 <= n; i += 4, p += 4)
+    vst1q_f32(d0 + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(p)), scale));
+#elif defined(DECIMATIONTREE_SSE2)
+  const __m128 s = _mm_set1_ps(scale);
+  for (; i + 4 <= n; i += 4, p += 4)
+    _mm_storeu_ps(d0 + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) p)), s));
+#endif
+  for (; i < n; ++i)
+    d0[i] = *p++ * scale;
+};
+
+static void
+toFloat2(const int32_t *p, int n, float scale, float *d0, float *d1) {
+  int i = 0;
+#if defined(DECIMATIONTREE_NEON)
+  for (; i + 4 <= n; i += 4, p += 8) {
+    int32x4x2_t x = vld2q_s32(p); // deinterleave 4 frames
+    vst1q_f32(d0 + i, vmulq_n_f32(vcvtq_f32_s32(x.val[0]), scale));
+    vst1q_f32(d1 + i, vmulq_n_f32(vcvtq_f32_s32(x.val[1]), scale));
+  }
+#elif defined(DECIMATIONTREE_SSE2)
+  const __m128 s = _mm_set1_ps(scale);
+  for (; i + 4 <= n; i += 4, p += 8) {
+    __m128 a = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) p));       // L0 R0 L1 R1
+    __m128 b = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) (p + 4))); // L2 R2 L3 R3
+    _mm_storeu_ps(d0 + i, _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), s));
+    _mm_storeu_ps(d1 + i, _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), s));
+  }
+#endif
+  for (; i < n; ++i) {
+    d0[i] = *p++ * scale;
+    d1[i] = *p++ * scale;
+  }
+};
+
+/*
+  the same for N interleaved channels, or nc of them if N is 0; with N
+  fixed, the channel loop is unrolled.
+*/
+
+template < int N, typename T >
+static void
+toFloatN(const T *p, int n, unsigned nc, float scale, float * const *d) {
+  const unsigned chans = N ? N : nc;
+  for (int i = 0; i < n; ++i, p += chans)
+    for (unsigned c = 0; c < chans; ++c)
+      d[c][i] = p[c] * scale;
+};
+
+/*
+  convert n frames of nc interleaved channels, using the kernel
+  specialized for nc if there is one
+*/
+
+template < typename T >
+static void
+toFloatChans(const T *p, int n, unsigned nc, float scale, float * const *d) {
+  switch (nc) {
+  case 1:
+    toFloat1(p, n, scale, d[0]);
+    break;
+  case 2:
+    toFloat2(p, n, scale, d[0], d[1]);
+    break;
+  case 4:
+    toFloatN < 4 > (p, n, nc, scale, d);
+    break;
+  case 8:
+    toFloatN < 8 > (p, n, nc, scale, d);
+    break;
+  default:
+    toFloatN < 0 > (p, n, nc, scale, d);
+    break;
+  }
+};
+
+DecimationTree::DecimationTree(unsigned numChan) :
+  numChan(numChan),
+  wide(false)
+{
+};
+
+DecimationTree::Node *
+DecimationTree::getNode(int factor, DownSampler::Mode mode) {
+  if (factor < 1)
+    factor = 1;
+  if (factor == 1)
+    mode = DownSampler::DS_SUBSAMPLE; // all modes are the same at full rate
+  Key key(factor, mode);
+  NodeMap::iterator in = nodes.find(key);
+  if (in != nodes.end())
+    return in->second.get();
+
+  // find the existing stream with the largest factor that divides this
+  // one's and gives the same samples as the hardware frames would: any
+  // full-rate stream, or for subsampling, any subsampled stream
+
+  Node * parent = 0;
+  for (NodeMap::iterator ip = nodes.begin(); ip != nodes.end(); ++ip) {
+    Node * n = ip->second.get();
+    bool exact = n->factor == 1 || (mode == DownSampler::DS_SUBSAMPLE && n->mode == DownSampler::DS_SUBSAMPLE);
+    if (n->factor < factor && factor % n->factor == 0 && exact
+        && (! parent || n->factor > parent->factor))
+      parent = n;
+  }
+
+  boost::shared_ptr < Node > node (new Node);
+  node->factor = factor;
+  node->mode = mode;
+  node->parent = parent;
+  node->numChildren = 0;
+  node->downSampler.reset(parent ? factor / parent->factor : factor, mode, numChan);
+  node->samples = 0;
+  node->wideSamples = 0;
+  node->avail = 0;
+  if (parent)
+    ++ parent->numChildren;
+  nodes[key] = node;
+  return node.get();
+};
+
+void
+DecimationTree::prune() {
+  // removing a stream can leave its parent unused, so repeat until nothing changes
+  bool pruned;
+  do {
+    pruned = false;
+    for (NodeMap::iterator in = nodes.begin(); in != nodes.end(); /**/) {
+      Node * n = in->second.get();
+      if (n->numChildren == 0 && n->rawListeners.empty() && n->plugins.empty()) {
+        if (n->parent)
+          -- n->parent->numChildren;
+        nodes.erase(in++);
+        pruned = true;
+      } else {
+        ++in;
+      }
+    }
+  } while (pruned);
+};
+
+void
+DecimationTree::process(const int16_t *hw, int frames) {
+  wide = false;
+  processAs(hw, frames);
+};
+
+void
+DecimationTree::process(const int32_t *hw, int frames) {
+  wide = true;
+  processAs(hw, frames);
+};
+
+template < typename T >
+void
+DecimationTree::processAs(const T *hw, int frames) {
+  for (NodeMap::iterator in = nodes.begin(); in != nodes.end(); ++in) {
+    Node * n = in->second.get();
+    const T * src = n->parent ? samplesOf(n->parent, hw) : hw;
+    int srcFrames = n->parent ? n->parent->avail : frames;
+    if (n->downSampler.factor <= 1) {
+      samplesOf(n, hw) = src;
+      n->avail = srcFrames;
+      continue;
+    }
+    // a stream never has more frames than its source
+    std::vector < T > & buf = bufOf(n, hw);
+    if (buf.size() < srcFrames * numChan)
+      buf.resize(srcFrames * numChan);
+    n->avail = n->downSampler.process(src, & buf[0], srcFrames);
+    samplesOf(n, hw) = & buf[0];
+  }
+};
+
+void
+DecimationTree::demodFM(Node * node, float scale) {
+  if (node->fmBuf.size() < (unsigned) node->avail)
+    node->fmBuf.resize(node->avail);
+  if (wide)
+    node->fmDemod.process(node->wideSamples, & node->fmBuf[0], node->avail, scale);
+  else
+    node->fmDemod.process(node->samples, & node->fmBuf[0], node->avail, scale);
+};
+
+void
+DecimationTree::toFloat(Node * node, float scale) {
+  if (node->avail == 0)
+    return;
+  for (unsigned c = 0; c < numChan; ++c) {
+    if (node->floats[c].size() < (unsigned) node->avail)
+      node->floats[c].resize(node->avail);
+    node->floatChans[c] = & node->floats[c][0];
+  }
+  if (wide)
+    toFloatChans(node->wideSamples, node->avail, numChan, scale, node->floatChans);
+  else
+    toFloatChans(node->samples, node->avail, numChan, scale, node->floatChans);
+};
+
+int
+DecimationTree::numRawListeners() {
+  int n = 0;
+  for (NodeMap::iterator in = nodes.begin(); in != nodes.end(); ++in)
+    n += in->second->rawListeners.size();
+  return n;
+};
+
+int
+DecimationTree::numPlugins() {
+  int n = 0;
+  for (NodeMap::iterator in = nodes.begin(); in != nodes.end(); ++in)
+    n += in->second->plugins.size();
+  return n;
+};
@@ -0,0 +1,97 @@
+#ifndef DECIMATIONTREE_HPP
+#define DECIMATIONTREE_HPP
+
+/*
+  A set of downsampled streams computed from one device's hardware
+  frames, one for each distinct (factor, mode) requested by the
+  device's consumers (raw listeners, file writers, and plugins).
+
+  Each rate is computed once per block no matter how many consumers
+  want it.  A subsampled stream is computed from the subsampled stream
+  with the largest factor that divides its own, as keeping every Nth
+  frame of every Mth frame keeps every (N*M)th hardware frame, so lower
+  rates reuse the work done for higher ones.  Averaged and FIR-filtered
+  streams are always computed from the hardware frames (or a full-rate
+  stream, which is the same): a cascade of those filters has a different
+  response from a single one, which would make a consumer's samples
+  depend on which other streams the device happened to have.
+
+  Streams are only ever added as leaves, and are kept while they have
+  consumers or downstream streams, so adding or removing a consumer never
+  disturbs the state of any other consumer's stream.
+
+  Hardware frames are S16, or S32 for devices with wider samples; the
+  streams are the same type as the latest block of hardware frames.
+*/
+
+#include <map>
+#include <vector>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "DownSampler.hpp"
+#include "FMDemod.hpp"
+
+class Pollable;
+class PluginRunner;
+
+typedef std::map < std::string, boost::weak_ptr < Pollable > > RawListenerSet;
+typedef std::map < std::string, boost::weak_ptr < PluginRunner > > PluginRunnerSet;
+
+class DecimationTree {
+
+public:
+  typedef std::pair < int, DownSampler::Mode > Key; // (factor relative to hardware rate, mode)
+
+  struct Node {
+    int               factor;         // downsampling factor relative to hardware rate
+    DownSampler::Mode mode;           // how downsampling is done
+    Node *            parent;         // stream this one is computed from; 0 means hardware frames
+    int               numChildren;    // number of streams computed from this one
+    DownSampler       downSampler;    // downsamples parent's stream by factor / parent->factor
+    std::vector < int16_t > buf;      // output for the current block, unless factor is 1
+    const int16_t *   samples;        // interleaved output for current block
+    std::vector < int32_t > wideBuf;  // the same, for S32 frames
+    const int32_t *   wideSamples;
+    int               avail;          // number of frames at samples
+    FMDemod           fmDemod;        // FM discriminator for raw listeners
+    std::vector < int16_t > fmBuf;    // FM-demodulated output for the current block
+    std::vector < float > floats[DownSampler::MAX_CHANNELS]; // current block, deinterleaved and scaled for plugins
+    float *           floatChans[DownSampler::MAX_CHANNELS]; // pointers to floats[], in the form plugins take
+    RawListenerSet    rawListeners;   // raw listeners wanting this stream
+    PluginRunnerSet   plugins;        // plugins wanting this stream
+  };
+
+  typedef std::map < Key, boost::shared_ptr < Node > > NodeMap; // iteration order has parents before children
+
+  NodeMap nodes;
+
+  DecimationTree(unsigned numChan);
+
+  Node * getNode(int factor, DownSampler::Mode mode); // find or add the stream for factor and mode
+  void prune();                       // drop streams without consumers or children
+  void process(const int16_t *hw, int frames); // compute all streams for a block of hardware frames
+  void process(const int32_t *hw, int frames); // the same, for S32 frames
+  bool isWide() {return wide;};       // was the latest block S32?
+  void demodFM(Node * node, float scale); // FM-demodulate node's current block into its fmBuf
+  void toFloat(Node * node, float scale); // convert node's current block into its floats
+
+  int numRawListeners();
+  int numPlugins();
+
+protected:
+  unsigned numChan;
+  bool     wide;                      // was the latest block S32?
+
+  // a node's output buffer and pointer for samples of type T
+  static std::vector < int16_t > & bufOf(Node * n, const int16_t *) {return n->buf;};
+  static std::vector < int32_t > & bufOf(Node * n, const int32_t *) {return n->wideBuf;};
+  static const int16_t * & samplesOf(Node * n, const int16_t *) {return n->samples;};
+  static const int32_t * & samplesOf(Node * n, const int32_t *) {return n->wideSamples;};
+
+  template < typename T >
+  void processAs(const T *hw, int frames);
+};
+
+#endif // DECIMATIONTREE_HPP
@@ -1,29 +1,40 @@
 #include "DevMinder.hpp"
+#include "RTSched.hpp"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <iostream>
 
 // declarations of subclasses for factory method
 
 #include "AlsaMinder.hpp"
 #include "RTLSDRMinder.hpp"
+#include "RTLSDRShmMinder.hpp"
+#include "ChannelMinder.hpp"
+#include "FileMinder.hpp"
 
 void DevMinder::delete_privates() {
   if (Pollable::terminating)
     return;
-  for (PluginRunnerSet::iterator ip = plugins.begin(); ip != plugins.end(); /**/) {
-    Pollable::remove(ip->first);
-    PluginRunnerSet::iterator del = ip++;
-    plugins.erase(del);
+  for (DecimationTree::NodeMap::iterator in = decim.nodes.begin(); in != decim.nodes.end(); ++in) {
+    PluginRunnerSet & plugins = in->second->plugins;
+    for (PluginRunnerSet::iterator ip = plugins.begin(); ip != plugins.end(); /**/) {
+      Pollable::remove(ip->first);
+      PluginRunnerSet::iterator del = ip++;
+      plugins.erase(del);
+    }
   }
+  decim.prune();
 };
 
 int DevMinder::open() {
-  int rv = hw_open();
-  downSampleFactor = hwRate / rate;
-  return rv;
+  return hw_open();
 };
 
 void DevMinder::stop(double timeNow) {
   shouldBeRunning = false;
   Pollable::requestPollFDRegen();
+  stopCaptureThread();
   hw_do_stop();
   stopTimestamp = timeNow;
   stopped = true;
@@ -37,60 +48,90 @@ int DevMinder::do_restart(double timeNow) {
 
 int DevMinder::start(double timeNow) {
   shouldBeRunning = true;
-  if (hw_running(timeNow))
+  if (captureThread)
     return 0;
-  if (!hw_is_open() && hw_open())
+  if (hw_running(timeNow)) {
+    startCaptureThread();
+    return 0;
+  }
+
+  // If stop left the hardware open, just restart it; if that doesn't
+  // work, fall back to reopening it from scratch.
+  uint64_t t0 = StatHistogram::nowNS();
+  bool fast = hw_is_open();
+  if (!fast && hw_open())
     return 1;
   Pollable::requestPollFDRegen();
   int rv = hw_do_start();
+  if (rv && fast) {
+    hw_close();
+    fast = false;
+    rv = hw_open() || hw_do_start();
+  }
   if (! rv) {
+    uint64_t ns = StatHistogram::nowNS() - t0;
+    startNS.record(ns);
+    (fast ? fastStarts : fullStarts).add();
+    lastStartSeconds = ns / 1.0e9;
+    lastStartFast = fast;
     stopped = false;
     // set timestamps to:
     // - prevent warning about resuming after long pause
     // - allow us to notice no data has been received for too long after startup
     lastDataReceived = startTimestamp = timeNow;
+    if (wide) {
+      if (wideSampleBuf.size() < sampleBuf.size())
+        wideSampleBuf.resize(sampleBuf.size());
+      RTSched::prefault(& wideSampleBuf[0], wideSampleBuf.size() * sizeof(wideSampleBuf[0]));
+    } else {
+      RTSched::prefault(& sampleBuf[0], sampleBuf.size() * sizeof(sampleBuf[0]));
+    }
+    startCaptureThread();
   }
   return rv;
 };
 
 void DevMinder::addPluginRunner(std::string &label, boost::shared_ptr < PluginRunner > pr) {
-  plugins[label] = pr;
+  decim.getNode(hwRate / pr->getRate(), decimMode)->plugins[label] = pr;
 };
 
 void DevMinder::removePluginRunner(std::string &label) {
   // remove plugin runner
-  plugins.erase(label);
+  for (DecimationTree::NodeMap::iterator in = decim.nodes.begin(); in != decim.nodes.end(); ++in)
+    in->second->plugins.erase(label);
+  decim.prune();
 };
 
-void DevMinder::addRawListener(string &label, int downSampleFactor, bool writeWavHeader, bool downSampleUseAvg) {
+void DevMinder::addRawListener(string &label, int downSampleFactor, bool writeWavHeader, DownSampler::Mode mode) {
+
+  // a listener only receives one stream
+  for (DecimationTree::NodeMap::iterator in = decim.nodes.begin(); in != decim.nodes.end(); ++in)
+    in->second->rawListeners.erase(label);
+  decim.prune();
 
   boost::shared_ptr < Pollable > sptr;
-  rawListeners[label] = sptr = Pollable::lookupByNameShared(label);
-  if (rawListeners.size() == 1) {
-    this->downSampleFactor = downSampleFactor;
-    this->downSampleUseAvg = downSampleUseAvg;
-    for (int i=0; i < MAX_CHANNELS; ++i) {
-      downSampleAccum[i] = 0;
-      downSampleCount[i] = downSampleFactor;
-    }
-  }
+  decim.getNode(downSampleFactor, mode)->rawListeners[label] = sptr = Pollable::lookupByNameShared(label);
   if (writeWavHeader) {
     Pollable *ptr = sptr.get();
     if (ptr) {
       // default max possible frames in .WAV header
-      // FIXME: hardcoded S16_LE format
-      WavFileHeader hdr(hwRate / downSampleFactor, numChan, 0x7ffffffe / 2);
+      int frameBytes = rawChannels() * rawSampleBytes();
+      WavFileHeader hdr(hwRate / downSampleFactor, rawChannels(), 0x7ffffffe / frameBytes, 8 * rawSampleBytes());
       ptr->queueOutput(hdr.address(), hdr.size());
     }
   }
 };
 
 void DevMinder::removeRawListener(string &label) {
-  rawListeners.erase(label);
+  for (DecimationTree::NodeMap::iterator in = decim.nodes.begin(); in != decim.nodes.end(); ++in)
+    in->second->rawListeners.erase(label);
+  decim.prune();
 };
 
 void DevMinder::removeAllRawListeners() {
-  rawListeners.clear();
+  for (DecimationTree::NodeMap::iterator in = decim.nodes.begin(); in != decim.nodes.end(); ++in)
+    in->second->rawListeners.clear();
+  decim.prune();
 };
 
 DevMinder::DevMinder(const string &devName, int rate, unsigned int numChan, unsigned int maxSampleAbs, const string &label, double now, int buffSize):
@@ -99,6 +140,8 @@ DevMinder::DevMinder(const string &devName, int rate, unsigned int numChan, unsi
   rate(rate),
   numChan(numChan),
   maxSampleAbs(maxSampleAbs),
+  wide(false),
+  decim(numChan),
   totalFrames(0),
   startTimestamp(-1.0),
   stopTimestamp(now),
@@ -107,20 +150,58 @@ DevMinder::DevMinder(const string &devName, int rate, unsigned int numChan, unsi
   stopped(true),
   hasError(0),
   demodFMForRaw(false),
-  demodFMLastTheta(0),
-  sampleBuf(buffSize * numChan)
+  decimMode(DownSampler::DS_SUBSAMPLE),
+  reqPeriodFrames(0),
+  reqBufferFrames(0),
+  reqWakeups(0),
+  sampleBuf(buffSize * numChan),
+  channelizer(0),
+  captureThread(0),
+  captureQuit(false),
+  captureWakeFD(-1),
+  captureRing(0),
+  captureBlocks(0),
+  captureDroppedFrames(0),
+  captureError(0),
+  frameIndex(0),
+  overruns(0),
+  overrunFrames(0),
+  timelineGaps(0),
+  timelineGapFrames(0),
+  reportedOverruns(0),
+  reportedLostFrames(0),
+  lastStartSeconds(-1),
+  lastStartFast(false)
 {
 };
 
 
-DevMinder * DevMinder::getDevMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now) {
+DevMinder * DevMinder::getDevMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now, DownSampler::Mode decimMode,
+                                     int periodFrames, int bufferFrames, double wakeups, const string & format) {
+
+  if (numChan < 1 || numChan > (unsigned) MAX_CHANNELS) {
+    ostringstream msg;
+    msg << "NUM_CHANNELS must be between 1 and " << MAX_CHANNELS;
+    throw std::runtime_error(msg.str());
+  }
 
   DevMinder * dev;
   if (devName.substr( 0, 7 ) == "rtlsdr:") {
     dev = new RTLSDRMinder(devName, rate, numChan, label, now);
+  } else if (devName.substr( 0, 11 ) == "rtlsdr-shm:") {
+    dev = new RTLSDRShmMinder(devName, rate, numChan, label, now);
+  } else if (devName.substr( 0, 5 ) == "chan:") {
+    dev = new ChannelMinder(devName, rate, numChan, label, now);
+  } else if (devName.substr( 0, 5 ) == "file:" || devName.substr( 0, 9 ) == "filefast:") {
+    dev = new FileMinder(devName, rate, numChan, label, now);
   } else {
     dev = new AlsaMinder(devName, rate, numChan, label, now);
   }
+  dev->decimMode = decimMode;
+  dev->reqPeriodFrames = periodFrames;
+  dev->reqBufferFrames = bufferFrames;
+  dev->reqWakeups = wakeups;
+  dev->reqFormat = format;
   if (dev->open()) {
     // there was an error, so throw an exception
     dev->delete_privates();
@@ -130,6 +211,10 @@ DevMinder * DevMinder::getDevMinder(const string &devName, int rate, unsigned in
 };
 
 DevMinder::~DevMinder() {
+  stopCaptureThread();
+  delete captureRing;
+  delete captureBlocks;
+  delete channelizer;
   delete_privates();
 };
 
@@ -137,6 +222,18 @@ string DevMinder::about() {
   return "Device '" + label + "' = " + devName;
 };
 
+void DevMinder::addStatsFields(std::ostream & s) {
+  s << ",\"totalFrames\":" << totalFrames
+    << ",\"framesPerEvent\":" << framesPerEvent.toJSON()
+    << ",\"getFramesNS\":" << getFramesNS.toJSON()
+    << ",\"decimNS\":" << decimNS.toJSON()
+    << ",\"demodNS\":" << demodNS.toJSON()
+    << ",\"channelizeNS\":" << channelizeNS.toJSON()
+    << ",\"startNS\":" << startNS.toJSON()
+    << ",\"fastStarts\":" << fastStarts.get()
+    << ",\"fullStarts\":" << fullStarts.get();
+};
+
 string DevMinder::toJSON() {
   ostringstream s;
   s << "{"
@@ -145,23 +242,74 @@ string DevMinder::toJSON() {
     << "\"rate\":" << rate << ","
     << "\"hwRate\":" << hwRate << ","
     << "\"numChan\":" << numChan << ","
+    << "\"decimation\":\"" << DownSampler::modeName(decimMode) << "\","
+    << "\"format\":\"" << hw_formatName() << "\","
+    << "\"rawFormat\":\"" << (rawSampleBytes() == 4 ? "S32_LE" : "S16_LE") << "\","
+    << "\"periodFrames\":" << hw_periodFrames() << ","
+    << "\"bufferFrames\":" << hw_bufferFrames() << ","
+    << "\"wakeupsPerSecond\":" << (hw_periodFrames() > 0 ? (double) hwRate / hw_periodFrames() : 0) << ","
+    << "\"bufferSeconds\":" << (hwRate > 0 ? (double) hw_bufferFrames() / hwRate : 0) << ","
     << setprecision(14)
     << "\"startTimestamp\":" << startTimestamp << ","
     << "\"stopTimestamp\":" << stopTimestamp << ","
     << "\"running\":" << (stopped ? "false" : "true") << ","
     << "\"hasError\":" << hasError << ","
     << "\"totalFrames\":" << totalFrames << ","
-    << "\"numRawListeners\":" << rawListeners.size()
+    << "\"captureThread\":" << (captureThread ? "true" : "false") << ","
+    << "\"captureDroppedFrames\":" << captureDroppedFrames << ","
+    << "\"overruns\":" << overruns << ","
+    << "\"overrunFrames\":" << overrunFrames << ","
+    << "\"timelineGaps\":" << timelineGaps << ","
+    << "\"timelineGapFrames\":" << timelineGapFrames << ","
+    << "\"clock\":" << clock.toJSON() << ","
+    << "\"lastStartSeconds\":" << lastStartSeconds << ","
+    << "\"lastStartFast\":" << (lastStartFast ? "true" : "false") << ","
+    << "\"numRawListeners\":" << decim.numRawListeners() << ","
+    << "\"channelizer\":" << (channelizer ? channelizer->numChannels() : 0) << ","
+    << "\"numChannelDevs\":" << channelDevs.size() << ","
+    << "\"streams\":[";
+  for (DecimationTree::NodeMap::iterator in = decim.nodes.begin(); in != decim.nodes.end(); ++in) {
+    DecimationTree::Node * n = in->second.get();
+    s << (in == decim.nodes.begin() ? "" : ",")
+      << "{\"rate\":" << hwRate / n->factor
+      << ",\"decimation\":\"" << DownSampler::modeName(n->mode) << "\""
+      << ",\"numRawListeners\":" << n->rawListeners.size()
+      << ",\"numPlugins\":" << n->plugins.size()
+      << "}";
+  }
+  s << "]"
     << "}";
   return s.str();
 }
 
 int DevMinder::getNumPollFDs () {
+  if (captureThread)
+    return 1;
+  if (swept())
+    return 0;
   return hw_getNumPollFDs();
 };
 
+bool DevMinder::swept() {
+  return useSweepTimer && ! captureThread && hw_sweepable();
+};
+
+bool DevMinder::sweep(double timeNow) {
+  if (! swept() || ! shouldBeRunning || ! hw_is_open())
+    return false;
+  long long before = totalFrames;
+  readFrames(hw_availNow(), timeNow);
+  return totalFrames != before;
+};
+
 int DevMinder::getPollFDs (struct pollfd *pollfds) {
   // append pollfd(s) for this object to the specified vector
+  // With a capture thread, the main loop only waits on its wakeup eventfd.
+  if (captureThread) {
+    pollfds->fd = captureWakeFD;
+    pollfds->events = POLLIN;
+    return 0;
+  }
   if ( hw_getPollFDs(pollfds) ) {
     std::ostringstream msg;
     msg << "\"event\":\"devProblem\",\"error\":\"snd_pcm_poll_descriptors returned error.\",\"devLabel\":\"" << label << "\"";
@@ -172,119 +320,280 @@ int DevMinder::getPollFDs (struct pollfd *pollfds) {
 }
 
 void DevMinder::handleEvents ( struct pollfd *pollfds, bool timedOut, double timeNow) {
-  int avail = hw_handleEvents(pollfds, timedOut);
+  if (captureThread) {
+    if (! timedOut && (pollfds->revents & POLLIN)) {
+      uint64_t count;
+      // reset the eventfd counter; all queued blocks are consumed below
+      if (read(captureWakeFD, & count, sizeof(count)) < 0 && errno != EAGAIN)
+        std::cerr << "read from capture eventfd failed for " << label << std::endl;
+    }
+    handleCaptureEvents(timedOut, timeNow);
+    return;
+  }
+
+  readFrames(hw_handleEvents(pollfds, timedOut), timeNow);
+};
+
+void DevMinder::deviceError(int err) {
+  std::ostringstream msg;
+  msg << "\"event\":\"devProblem\",\"error\":\" device returned with error " << (- err) << "\",\"devLabel\":\"" << label << "\"";
+  Pollable::asyncMsg(msg.str());
+  hw_do_restart();
+};
+
+void DevMinder::readFrames(int avail, double timeNow) {
   if (avail < 0) {
-    std::ostringstream msg;
-    msg << "\"event\":\"devProblem\",\"error\":\" device returned with error " << (- avail) << "\",\"devLabel\":\"" << label << "\"";
-    Pollable::asyncMsg(msg.str());
-    hw_do_restart();
+    deviceError(avail);
     return;
   }
 
   if (avail > 0)
     lastDataReceived = timeNow;
 
-  if (avail * numChan > sampleBuf.capacity()) {
-    sampleBuf.resize(avail * numChan);
+  if (avail > 0 && useZeroCopy) {
+    // process straight from the hardware's buffer, which isn't handed
+    // back until every consumer has taken what it needs.  Frames can
+    // only be peeked up to the end of the hardware's ring, so those
+    // past the wrap point are a second block.
+    int rv = 0;
+    int got = 0;
+    while (got < avail) {
+      const int16_t * frames;
+      double frameTimestamp;
+      uint64_t t0 = StatHistogram::nowNS();
+      rv = hw_peekFrames (frames, avail - got, frameTimestamp);
+      getFramesNS.record(StatHistogram::nowNS() - t0);
+      if (rv <= 0)
+        break;
+      totalFrames += rv;
+      processFrames(frames, rv, frameTimestamp);
+      hw_releaseFrames();
+      got += rv;
+    }
+    if (rv != -ENOSYS || got > 0) {
+      reportOverruns();
+      if (rv < 0 && rv != -ENOSYS)
+        deviceError(rv);
+      else if (got == 0)
+        checkForStall(timeNow);
+      return;
+    }
+  }
+
+  if (wide)
+    copyFrames(wideSampleBuf, avail, timeNow);
+  else
+    copyFrames(sampleBuf, avail, timeNow);
+};
+
+template < typename T >
+void DevMinder::copyFrames(std::vector < T > & buf, int avail, double timeNow) {
+  if (avail * numChan > buf.capacity()) {
+    buf.resize(avail * numChan);
   }
 
   double frameTimestamp;
 
-  avail = hw_getFrames (& sampleBuf[0], avail, frameTimestamp);
-
-  totalFrames += avail;
-
-  if (avail > 0) {
-
-    // FIXME: assumes interleaved channels
-    // now downsample sampleBuf, using the running accumulator.
-    // We downsample in-place, keeping track of the destination
-    // index in downSampleAvail;
-
-    int downSampleAvail = avail;
-
-    if (downSampleFactor > 1) {
-      for (unsigned j = 0; j < numChan; ++j) {
-        downSampleAvail = 0; // works the same for all channels
-        if (downSampleUseAvg) {
-          int16_t * rs = & sampleBuf[j];
-          int16_t * ds = rs;
-          for (int i=0; i < avail; ++i) {
-            downSampleAccum[j] += *rs;
-            rs += numChan;
-            if (! --downSampleCount[j]) {
-              downSampleCount[j] = downSampleFactor;
-              // simple dithering: round to nearest int, but retain remainder in downSampleAccum
-              int16_t downSample = (downSampleAccum[j] + downSampleFactor / 2) / downSampleFactor;
-              *ds = downSample;
-              downSampleAccum[j] -= downSample * downSampleFactor;
-              ds += numChan;
-              ++ downSampleAvail;
-            }
-          }
-        } else {
-          int16_t * rs = & sampleBuf[j];
-          int16_t * ds = rs;
-          for (int i=0; i < avail; ++i) {
-            if (! --downSampleCount[j]) {
-              downSampleCount[j] = downSampleFactor;
-              *ds = *rs;
-              ds += numChan;
-              ++ downSampleAvail;
-            }
-            rs += numChan;
-          }
-        }
-      }
-    }
-    // if requested, do FM demodulation of the downsamples,
-    if (numChan == 2 && demodFMForRaw) {
-      // do in-place FM demodulation with simple but expensive arctan!
-      // only first avail slots in sampleBuf will end up valid
-      float dthetaScale = hwRate / (2 * M_PI) / 75000.0 * 32767.0;
-      for (int i=0; i < downSampleAvail; ++i) {
-        // get phase angle in -pi..pi
-        float theta = atan2f(sampleBuf[2*i], sampleBuf[2*i+1]);
-        float dtheta = theta - demodFMLastTheta;
-        demodFMLastTheta = theta;
-        if (dtheta > M_PI) {
-          dtheta -= 2 * M_PI;
-        } else if (dtheta < -M_PI) {
-          dtheta += 2 * M_PI;
-        }
-        sampleBuf[i] = roundf(dthetaScale * dtheta);
-      }
-    }
+  uint64_t t0 = StatHistogram::nowNS();
+  avail = getFrames (& buf[0], avail, frameTimestamp);
+  getFramesNS.record(StatHistogram::nowNS() - t0);
 
+  reportOverruns();
 
-    // there are now downSampleAvail samples, stored in sampleBuf[0..downSampleAvail * numChan - 1]
+  if (avail < 0) {
+    deviceError(avail);
+  } else if (avail > 0) {
+    totalFrames += avail;
+    processFrames(& buf[0], avail, frameTimestamp);
+  } else {
+    checkForStall(timeNow);
+  }
+};
 
-    for (RawListenerSet::iterator ir = rawListeners.begin(); ir != rawListeners.end(); /**/) {
+void DevMinder::processFrames(const int16_t * frames, int avail, double frameTimestamp) {
+  processFramesAs(frames, avail, frameTimestamp);
+};
 
-      if (Pollable * ptr = (ir->second).lock().get()) {
-        ptr->queueOutput((char *) & sampleBuf[0], downSampleAvail * 2 * numChan, frameTimestamp ); // NB: hardcoded S16_LE sample size
-        ++ir;
-      } else {
-        RawListenerSet::iterator to_delete = ir++;
-        rawListeners.erase(to_delete);
+void DevMinder::processFrames(const int32_t * frames, int avail, double frameTimestamp) {
+  processFramesAs(frames, avail, frameTimestamp);
+};
+
+template < typename T >
+void DevMinder::processFramesAs(const T * frames, int avail, double frameTimestamp) {
+  // FIXME: assumes interleaved channels
+  // compute each stream wanted by a consumer from frames, then
+  // hand each stream to its consumers
+
+  framesPerEvent.record(avail);
+  if (channelizer)
+    channelize(frames, avail, frameTimestamp);
+  uint64_t t0 = StatHistogram::nowNS();
+  decim.process(frames, avail);
+  distribute(frameTimestamp, StatHistogram::nowNS() - t0);
+};
+
+void DevMinder::distribute(double frameTimestamp, uint64_t decimTime) {
+  // streams are S32 if decim's latest block was
+  bool w = decim.isWide();
+  bool deadConsumers = false;
+  for (DecimationTree::NodeMap::iterator in = decim.nodes.begin(); in != decim.nodes.end(); ++in) {
+    DecimationTree::Node * n = in->second.get();
+    if (n->avail == 0)
+      continue;
+
+    // if requested, raw listeners get FM demodulation of the stream, reducing stereo to mono
+    if (! n->rawListeners.empty()) {
+      const char * raw = w ? (const char *) n->wideSamples : (const char *) n->samples;
+      int rawBytes = n->avail * numChan * (w ? 4 : 2);
+      if (numChan == 2 && demodFMForRaw) {
+        float dthetaScale = hwRate / (2 * M_PI) / 75000.0 * 32767.0;
+        uint64_t t1 = StatHistogram::nowNS();
+        decim.demodFM(n, dthetaScale);
+        demodNS.record(StatHistogram::nowNS() - t1);
+        raw = (const char *) & n->fmBuf[0];
+        rawBytes = n->avail * 2;
+      }
+      // listeners share one copy of the block
+      OutputBlock::Ptr blk = OutputBlock::alloc(raw, rawBytes);
+      for (RawListenerSet::iterator ir = n->rawListeners.begin(); ir != n->rawListeners.end(); /**/) {
+        if (Pollable * ptr = (ir->second).lock().get()) {
+          ptr->queueOutput(blk, frameTimestamp);
+          ++ir;
+        } else {
+          RawListenerSet::iterator to_delete = ir++;
+          n->rawListeners.erase(to_delete);
+          deadConsumers = true;
+        }
       }
     }
+
     /*
-      copy from sampleBuf to each attached plugin's buffer,
-      converting from S16_LE to float, and calling the plugin if its
+      copy from the stream to each attached plugin's buffer,
+      converting from S16_LE or S32_LE to float, and calling the plugin if its
       buffer has reached blocksize
     */
 
-    for (PluginRunnerSet::iterator ip = plugins.begin(); ip != plugins.end(); /**/) {
+    // the conversion to float is done once for all plugins with the device's scale
+
+    float scale = 1.0 / maxSampleAbs;
+    if (! n->plugins.empty()) {
+      uint64_t t1 = StatHistogram::nowNS();
+      decim.toFloat(n, scale);
+      decimTime += StatHistogram::nowNS() - t1;
+    }
+
+    for (PluginRunnerSet::iterator ip = n->plugins.begin(); ip != n->plugins.end(); /**/) {
       if (boost::shared_ptr < PluginRunner > ptr = (ip->second).lock()) {
-        ptr->handleData(downSampleAvail, & sampleBuf[0], & sampleBuf[1], 2, frameTimestamp);
+        if (ptr->getScale() == scale && ptr->getNumChan() == numChan)
+          ptr->handleData(n->avail, n->floatChans, frameTimestamp);
+        else if (w)
+          ptr->handleData(n->avail, n->wideSamples, frameTimestamp);
+        else
+          ptr->handleData(n->avail, n->samples, frameTimestamp);
         ++ip;
       } else {
         PluginRunnerSet::iterator to_delete = ip++;
-        plugins.erase(to_delete);
+        n->plugins.erase(to_delete);
+        deadConsumers = true;
+      }
+    }
+  }
+  decimNS.record(decimTime);
+  if (deadConsumers)
+    decim.prune();
+};
+
+int DevMinder::addChannelDev(int numChannels, int k, const string & devLabel) {
+  if (numChan != 2) {
+    std::cerr << "only I/Q (2-channel) devices can be split into channels\n";
+    return 1;
+  }
+  if (channelizer && channelizer->numChannels() != numChannels) {
+    std::cerr << "device " << label << " is already split into " << channelizer->numChannels() << " channels\n";
+    return 2;
+  }
+  if (hwRate % numChannels != 0) {
+    std::cerr << "device " << label << "'s rate isn't a multiple of " << numChannels << "\n";
+    return 3;
+  }
+  if (k < 0 || k >= numChannels) {
+    std::cerr << "channel must be from 0 to " << numChannels - 1 << "\n";
+    return 4;
+  }
+  if (! channelizer) {
+    try {
+      channelizer = new Channelizer(numChannels);
+    } catch (std::runtime_error & e) {
+      std::cerr << e.what() << "\n";
+      return 5;
+    }
+  }
+  channelDevs[devLabel] = std::make_pair(k, boost::weak_ptr < Pollable > (Pollable::lookupByNameShared(devLabel)));
+  return 0;
+};
+
+template < typename T >
+void DevMinder::channelize(const T * frames, int avail, double frameTimestamp) {
+  // split frames into channels, and process each wanted channel as a
+  // block of its virtual device's hardware frames, which are S32 if
+  // this device's are
+
+  uint64_t t0 = StatHistogram::nowNS();
+  int n = channelizer->process(frames, avail);
+  if (n > 0) {
+    double ts = 0;
+    if (frameTimestamp > 0)
+      ts = frameTimestamp + (channelizer->firstOutputOffset() - channelizer->delayFrames()) / hwRate;
+    if ((int) channelBuf.size() < 2 * n)
+      channelBuf.resize(2 * n);
+    T * out = (T *) & channelBuf[0];
+    for (ChannelDevSet::iterator ic = channelDevs.begin(); ic != channelDevs.end(); /**/) {
+      boost::shared_ptr < Pollable > p = ic->second.second.lock();
+      if (! p) {
+        ChannelDevSet::iterator to_delete = ic++;
+        channelDevs.erase(to_delete);
+        continue;
+      }
+      DevMinder * dev = static_cast < DevMinder * > (p.get());
+      if (! dev->stopped) {
+        channelizer->getChannel(ic->second.first, out);
+        dev->totalFrames += n;
+        dev->processFrames(out, n, ts);
       }
+      ++ic;
     }
-  } else if (shouldBeRunning && lastDataReceived >= 0 && timeNow - lastDataReceived > MAX_DEV_QUIET_TIME
+  }
+  channelizeNS.record(StatHistogram::nowNS() - t0);
+  if (channelDevs.empty()) {
+    delete channelizer;
+    channelizer = 0;
+  }
+};
+
+bool DevMinder::consumersBacklogged() {
+  // a plugin is behind when its worker queue is half full, and a raw
+  // listener when its output buffer is; so are channelDevs' consumers
+
+  for (DecimationTree::NodeMap::iterator in = decim.nodes.begin(); in != decim.nodes.end(); ++in) {
+    DecimationTree::Node * n = in->second.get();
+    for (PluginRunnerSet::iterator ip = n->plugins.begin(); ip != n->plugins.end(); ++ip)
+      if (boost::shared_ptr < PluginRunner > ptr = (ip->second).lock())
+        if (ptr->queuedBlockCount() >= PluginRunner::MAX_QUEUED_BLOCKS / 2)
+          return true;
+    for (RawListenerSet::iterator ir = n->rawListeners.begin(); ir != n->rawListeners.end(); ++ir)
+      if (boost::shared_ptr < Pollable > ptr = (ir->second).lock())
+        if (ptr->outputSize() > ptr->outputReserve())
+          return true;
+  }
+  for (ChannelDevSet::iterator ic = channelDevs.begin(); ic != channelDevs.end(); ++ic)
+    if (boost::shared_ptr < Pollable > p = ic->second.second.lock())
+      if (static_cast < DevMinder * > (p.get())->consumersBacklogged())
+        return true;
+  return false;
+};
+
+void DevMinder::checkForStall(double timeNow) {
+  if (shouldBeRunning && lastDataReceived >= 0 && timeNow - lastDataReceived > MAX_DEV_QUIET_TIME
              && ! (timeNow > 1000000000 && lastDataReceived < 1000000000)) {
     // this device appears to have stopped delivering audio; try restart it
     std::ostringstream msg;
@@ -292,6 +601,7 @@ void DevMinder::handleEvents ( struct pollfd *pollfds, bool timedOut, double tim
     Pollable::asyncMsg(msg.str());
     lastDataReceived = timeNow; // wait before next restart
     stop(timeNow);
+    hw_close(); // whatever has gone wrong, a quick restart might not fix it
     Pollable::requestPollFDRegen();
   }
 };
@@ -299,5 +609,215 @@ void DevMinder::handleEvents ( struct pollfd *pollfds, bool timedOut, double tim
 
 void
 DevMinder::setDemodFMForRaw(bool demod) {
+  if (demod && ! demodFMForRaw)
+    for (DecimationTree::NodeMap::iterator in = decim.nodes.begin(); in != decim.nodes.end(); ++in)
+      in->second->fmDemod.reset();
   demodFMForRaw = demod;
 };
+
+void
+DevMinder::startCaptureThread() {
+  if (! useCaptureThreads || captureThread || ! hw_threadable())
+    return;
+
+  // size the rings on first use, now that hwRate and the sample width
+  // are known, and again if the hardware was reopened with others.  The
+  // sample ring is empty here, so all of it is available for writing.
+  unsigned ringWords = CAPTURE_RING_SECONDS * hwRate * numChan * (wide ? 2 : 1);
+  if (captureRing && captureRing->write_available() != ringWords) {
+    delete captureRing;
+    captureRing = 0;
+  }
+  if (! captureRing)
+    captureRing = new CaptureSampleRing(ringWords);
+  if (! captureBlocks)
+    captureBlocks = new CaptureBlockRing(CAPTURE_RING_BLOCKS);
+  captureWakeFD = eventfd(0, EFD_NONBLOCK);
+  if (captureWakeFD < 0) {
+    // fall back to reading the device from the main thread
+    std::ostringstream msg;
+    msg << "\"event\":\"devProblem\",\"error\":\"unable to create eventfd for capture thread\",\"devLabel\":\"" << label << "\"";
+    Pollable::asyncMsg(msg.str());
+    return;
+  }
+  captureQuit = false;
+  captureError = 0;
+  captureThread = new boost::thread(captureLoop, this);
+  RTSched::addThread("capture:" + label, captureThread->native_handle(), false);
+  Pollable::requestPollFDRegen();
+};
+
+void
+DevMinder::stopCaptureThread() {
+  if (! captureThread)
+    return;
+  RTSched::removeThread("capture:" + label);
+  captureQuit = true;
+  captureThread->join();
+  delete captureThread;
+  captureThread = 0;
+  close(captureWakeFD);
+  captureWakeFD = -1;
+  // the hardware is about to be stopped, so discard anything not yet consumed
+  captureRing->reset();
+  captureBlocks->reset();
+  Pollable::requestPollFDRegen();
+};
+
+void
+DevMinder::queueCaptureBlock(int frames, double timestamp) {
+  // called from the capture thread.  Samples must be queued before
+  // the block header, so the main thread never sees a header whose
+  // samples are not yet available.  An error isn't queued, so it can't
+  // be lost to a full ring: it's left in captureError for the main
+  // thread, which handles it once it has consumed the blocks before it.
+
+  if (frames > 0) {
+    unsigned n = frames * numChan * (wide ? 2 : 1);
+    if (captureRing->write_available() < n || ! captureBlocks->write_available()) {
+      captureDroppedFrames += frames;
+      return;
+    }
+    if (wide)
+      captureRing->push((const int16_t *) & wideCaptureBuf[0], n);
+    else
+      captureRing->push(& captureBuf[0], n);
+    CaptureBlock blk = {frames, timestamp};
+    captureBlocks->push(blk);
+  } else if (frames < 0) {
+    captureError = frames;
+  } else {
+    return;
+  }
+  uint64_t one = 1;
+  if (write(captureWakeFD, & one, sizeof(one)) < 0)
+    std::cerr << "write to capture eventfd failed for " << label << std::endl;
+};
+
+void
+DevMinder::captureLoop(DevMinder *dev) {
+  // drain the hardware into the capture rings until told to quit, or
+  // until the hardware returns an error.  Only hw_ methods which read
+  // the device, and the producer side of the rings, are used here;
+  // everything else, including reporting and recovering from errors,
+  // belongs to the main thread.
+
+  std::vector < struct pollfd > pollfds(dev->hw_getNumPollFDs());
+  if (pollfds.size() == 0 || dev->hw_getPollFDs(& pollfds[0])) {
+    dev->queueCaptureBlock(-EBADF, 0);
+    return;
+  }
+
+  while (! dev->captureQuit) {
+    int rv = ::poll(& pollfds[0], pollfds.size(), CAPTURE_POLL_TIMEOUT);
+    if (rv < 0) {
+      if (errno == EINTR)
+        continue;
+      dev->queueCaptureBlock(-errno, 0);
+      return;
+    }
+    int avail;
+    try {
+      avail = dev->hw_handleEvents(& pollfds[0], rv == 0);
+    } catch (std::runtime_error & e) {
+      avail = -EIO;
+    }
+    if (avail > 0) {
+      double frameTimestamp;
+      uint64_t t0 = StatHistogram::nowNS();
+      if (dev->wide) {
+        if (avail * dev->numChan > dev->wideCaptureBuf.size())
+          dev->wideCaptureBuf.resize(avail * dev->numChan);
+        avail = dev->hw_getWideFrames(& dev->wideCaptureBuf[0], avail, frameTimestamp);
+      } else {
+        if (avail * dev->numChan > dev->captureBuf.size())
+          dev->captureBuf.resize(avail * dev->numChan);
+        avail = dev->hw_getFrames(& dev->captureBuf[0], avail, frameTimestamp);
+      }
+      dev->getFramesNS.record(StatHistogram::nowNS() - t0);
+      if (avail > 0)
+        dev->queueCaptureBlock(avail, frameTimestamp);
+    }
+    if (avail < 0) {
+      dev->queueCaptureBlock(avail, 0);
+      return;
+    }
+  }
+};
+
+void
+DevMinder::handleCaptureEvents(bool timedOut, double timeNow) {
+  bool gotData = false;
+  CaptureBlock blk;
+  while (captureBlocks->pop(blk)) {
+    unsigned n = blk.frames * numChan;
+    totalFrames += blk.frames;
+    gotData = true;
+    if (wide) {
+      if (n > wideSampleBuf.size())
+        wideSampleBuf.resize(n);
+      captureRing->pop((int16_t *) & wideSampleBuf[0], 2 * n);
+      processFrames(& wideSampleBuf[0], blk.frames, blk.timestamp);
+    } else {
+      if (n > sampleBuf.size())
+        sampleBuf.resize(n);
+      captureRing->pop(& sampleBuf[0], n);
+      processFrames(& sampleBuf[0], blk.frames, blk.timestamp);
+    }
+  }
+  reportOverruns();
+
+  int err = captureError.exchange(0);
+  if (err) {
+    // the thread has quit; restart the hardware here, and then the thread.
+    // If the thread couldn't even get the device's fds, read the device
+    // from the main thread instead.
+    std::ostringstream msg;
+    msg << "\"event\":\"devProblem\",\"error\":\" device returned with error " << (- err) << "\",\"devLabel\":\"" << label << "\"";
+    Pollable::asyncMsg(msg.str());
+    stopCaptureThread();
+    if (err != -EBADF) {
+      hw_do_restart();
+      startCaptureThread();
+    }
+  }
+
+  if (gotData)
+    lastDataReceived = timeNow;
+  else
+    checkForStall(timeNow);
+};
+
+void
+DevMinder::noteOverrun(long long frames, bool fromTimeline) {
+  if (fromTimeline) {
+    ++ timelineGaps;
+    timelineGapFrames += frames;
+  } else {
+    ++ overruns;
+    overrunFrames += frames;
+  }
+};
+
+void
+DevMinder::reportOverruns() {
+  long long n = overruns + timelineGaps;
+  if (n == reportedOverruns)
+    return;
+  long long lost = overrunFrames + timelineGapFrames;
+  std::ostringstream msg;
+  msg << "\"event\":\"devOverrun\",\"devLabel\":\"" << label << "\""
+      << ",\"newOverruns\":" << n - reportedOverruns
+      << ",\"newLostFrames\":" << lost - reportedLostFrames
+      << ",\"overruns\":" << overruns
+      << ",\"overrunFrames\":" << overrunFrames
+      << ",\"timelineGaps\":" << timelineGaps
+      << ",\"timelineGapFrames\":" << timelineGapFrames;
+  Pollable::asyncMsg(msg.str());
+  reportedOverruns = n;
+  reportedLostFrames = lost;
+};
+
+bool DevMinder::useCaptureThreads = false;
+bool DevMinder::useZeroCopy = false;
+bool DevMinder::useSweepTimer = false;
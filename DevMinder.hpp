@@ -8,34 +8,66 @@
 #include <memory>
 #include <cmath>
 #include <vector>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <errno.h>
+#include <boost/lockfree/spsc_queue.hpp>
 
 using namespace std;
 
 #include "Pollable.hpp"
 #include "PluginRunner.hpp"
 #include "WavFileHeader.hpp"
+#include "DownSampler.hpp"
+#include "FMDemod.hpp"
+#include "DecimationTree.hpp"
+#include "TimestampEstimator.hpp"
+#include "Channelizer.hpp"
 
-typedef std::map < string, boost::weak_ptr < Pollable > > RawListenerSet;
-typedef std::map < string, boost::weak_ptr < PluginRunner > > PluginRunnerSet;
+// header for a block of frames passed from a device's capture thread to the main thread;
+// the block's samples are in the device's captureRing
+typedef struct {
+  int               frames;           // number of frames in block
+  double            timestamp;        // CLOCK_REALTIME for first frame in block
+} CaptureBlock;
+
+// virtual devices fed by a device's channelizer: label -> (channel index, device)
+typedef std::map < std::string, std::pair < int, boost::weak_ptr < Pollable > > > ChannelDevSet;
+
+typedef boost::lockfree::spsc_queue < int16_t > CaptureSampleRing; // S32 samples are queued as pairs of int16_t
+typedef boost::lockfree::spsc_queue < CaptureBlock > CaptureBlockRing;
 
 class DevMinder : public Pollable {
 
 public:
 
-  static const int  MAX_CHANNELS          = 2;      // maximum of two channels per device
+  static const int  MAX_CHANNELS          = DownSampler::MAX_CHANNELS; // maximum channels per device
   static const int  MAX_DEV_QUIET_TIME   = 30;     // 30 second maximum quiet time before we decide an device data stream is dry and try restart it
-
-  string             devName;          // path to device (e.g. hw:CARD=V10 for ALSA, or rtlsdr:/tmp/rtlsdr1:3 for rtl_tcp listening on /tmp/rtlsdr1:3
+  static const int  CAPTURE_RING_SECONDS  = 1;      // seconds of hardware-rate samples a capture thread can queue before dropping
+  static const int  CAPTURE_RING_BLOCKS   = 1024;   // maximum number of blocks a capture thread can queue
+  static const int  CAPTURE_POLL_TIMEOUT  = 500;    // milliseconds a capture thread waits in poll() before checking whether to quit
+  static const unsigned int WIDE_MAX_SAMPLE_ABS = 2147483648u; // maxSampleAbs for wide devices
+
+  static bool        useCaptureThreads; // if true, each started device reads its hardware on its own thread
+  static bool        useZeroCopy;      // if true, devices read on the main thread are processed straight from
+                                       // the hardware's buffer, where the hardware supports that
+  static bool        useSweepTimer;    // if true, devices which can be are read by a SweepTimer rather than
+                                       // waking the main loop themselves
+
+  string             devName;          // path to device (e.g. hw:CARD=V10 for ALSA, or rtlsdr:/tmp/rtlsdr1:3 for rtl_tcp listening on /tmp/rtlsdr1:3,
+                                       // or rtlsdr-shm:/tmp/rtlsdr1:3 for a shared-memory ring offered there, or file:/data/rec.wav for a recording)
   int                rate;             // sampling rate to supply plugins with
   unsigned int       hwRate;           // sampling rate of hardware device
   unsigned int       numChan;          // number of channels to read from device
   unsigned int       maxSampleAbs;     // maximum absolute value of sample
+  bool               wide;             // are samples carried as S32 rather than S16?  Set by hw_open, from the
+                                       // hardware's sample format; if so, frames are read by hw_getWideFrames
+                                       // and plugins, raw listeners, and channelDevs all get the S32 samples
 
 protected:
 
-  PluginRunnerSet   plugins;          // set of plugins accepting input from this device
-  RawListenerSet    rawListeners;     // listeners receiving raw output from this device, if
-                                      // any.
+  DecimationTree    decim;            // downsampled streams feeding plugins and raw listeners
+                                      // (which each choose their own rate)
   long long         totalFrames;      // total frames seen on this device since start of capture
   double            startTimestamp;   // timestamp device was (most recently) started (-1 if
                                       // never)
@@ -52,18 +84,59 @@ protected:
                                       // while we polled it? (this would have stopped it)
   bool              demodFMForRaw;    // if true, any rawListeners receive FM-demodulated
                                       // samples (reducing stereo to mono)
-  float             demodFMLastTheta; // value of previous phase angle for FM demodulation (in
-                                      // range -pi..pi)
-  int16_t           downSampleFactor; // by what factor do we downsample input audio for raw listeners
-  int16_t           downSampleCount[MAX_CHANNELS];  // count of how many samples we've accumulated since last down sample
-  int32_t           downSampleAccum[MAX_CHANNELS];  // accumulator for downsampling
-  bool              downSampleUseAvg; // if true, downsample by averaging; else downsample by subsampling
+  DownSampler::Mode decimMode;        // how to downsample, unless a raw listener requests otherwise
+  int               reqPeriodFrames;  // hardware frames per period requested at open; 0 means the device's default
+  int               reqBufferFrames;  // hardware frames of buffering requested at open; 0 means the device's default
+  double            reqWakeups;       // periods per second requested at open, if reqPeriodFrames is 0; 0 means the device's default
+  string            reqFormat;        // hardware sample format requested at open, by its ALSA name (e.g. "S24_3LE"); empty means the device's default
 
   std::vector < int16_t > sampleBuf;  // buffer to store latest interleaved samples from device
+  std::vector < int32_t > wideSampleBuf; // the same, for wide devices
+
+  Channelizer *     channelizer;      // if non-null, splits I/Q frames into narrow channels for channelDevs
+  ChannelDevSet     channelDevs;      // virtual devices (ChannelMinders) each fed one of channelizer's channels
+  std::vector < int32_t > channelBuf; // one channel's output for the current block, as S32 or (at the front) S16
+
+  boost::thread *   captureThread;    // if non-null, thread reading from hardware into captureRing
+  boost::atomic < bool > captureQuit; // set by main thread to tell captureThread to exit
+  int               captureWakeFD;    // eventfd written by captureThread after queueing a block; polled by main thread
+  CaptureSampleRing * captureRing;    // interleaved samples queued by captureThread
+  CaptureBlockRing  * captureBlocks;  // headers for blocks of samples in captureRing
+  boost::atomic < long long > captureDroppedFrames; // frames read by captureThread but dropped because main thread fell behind
+  boost::atomic < int > captureError; // non-zero: the hardware error code captureThread quit on, not yet handled by the main thread
+
+  // timestamps: hw_getFrames implementations feed occasional hardware
+  // timestamps to clock and report clock's estimate for each frame.
+  TimestampEstimator clock;           // estimates timestamps of hardware frames, and drift of the digitizer's clock
+  long long         frameIndex;       // index of next hardware frame to be read, counting frames lost to overruns
+
+  // overruns: frames lost because the device wasn't read in time.  Noted
+  // by whichever thread reads the device, and announced by the main thread.
+  boost::atomic < long long > overruns;          // overruns seen in the device's buffer fill level
+  boost::atomic < long long > overrunFrames;     // frames lost to those
+  boost::atomic < long long > timelineGaps;      // jumps in the device's timestamps not explained by the above
+  boost::atomic < long long > timelineGapFrames; // frames lost to those (estimated from the jump)
+  long long         reportedOverruns;  // overruns + timelineGaps already announced
+  long long         reportedLostFrames;// overrunFrames + timelineGapFrames already announced
+
+  // hot-path metrics, reported by the 'stats' command
+  StatHistogram     framesPerEvent;   // hardware frames handled per processFrames call
+  StatHistogram     getFramesNS;      // time in hw_getFrames (on whichever thread reads the device)
+  StatHistogram     decimNS;          // time computing downsampled streams and their float conversions
+  StatHistogram     demodNS;          // time FM-demodulating streams for raw listeners
+  StatHistogram     channelizeNS;     // time splitting frames into channels and feeding channelDevs
+  StatHistogram     startNS;          // time taken by each successful start
+  StatCounter       fastStarts;       // starts which reused the hardware left open by stop
+  StatCounter       fullStarts;       // starts which had to open the hardware
+  double            lastStartSeconds; // time taken by the most recent successful start; -1 if none
+  bool              lastStartFast;    // did it reuse the open hardware?
+  std::vector < int16_t > captureBuf; // buffer captureThread reads hardware frames into
+  std::vector < int32_t > wideCaptureBuf; // the same, for wide devices
 
 public:
 
-  static DevMinder * getDevMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now); // factory method
+  static DevMinder * getDevMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now, DownSampler::Mode decimMode = DownSampler::DS_SUBSAMPLE,
+                                  int periodFrames = 0, int bufferFrames = 0, double wakeups = 0, const string & format = ""); // factory method; see reqPeriodFrames etc. for the last four
   ~DevMinder();
 
   int open(); // return 0 on success, non-zero on error
@@ -71,14 +144,22 @@ public:
 
   virtual bool hw_is_open() = 0;
 
-  void addPluginRunner(std::string &label, boost::shared_ptr < PluginRunner > pr);
+  void addPluginRunner(std::string &label, boost::shared_ptr < PluginRunner > pr); // plugin receives frames at its own rate
   void removePluginRunner(std::string &label);
-  void addRawListener(string &label, int downSampleFactor, bool writeWavHeader = false, bool downSampleUseAvg = false);
+  void addRawListener(string &label, int downSampleFactor, bool writeWavHeader, DownSampler::Mode mode);
+  DownSampler::Mode getDecimMode() {return decimMode;};
+  double getDriftPPM() {return clock.driftPPM();}; // digitizer clock rate relative to nominal, in ppm
   void removeRawListener(string &label);
   void removeAllRawListeners();
+  int rawChannels() {return (demodFMForRaw && numChan == 2) ? 1 : numChan;}; // channels raw listeners receive
+  int rawSampleBytes() {return wide && ! (demodFMForRaw && numChan == 2) ? 4 : 2;}; // bytes per sample raw listeners receive: S32_LE or S16_LE
 
   string about();
   string toJSON();
+  void addStatsFields(std::ostream & s);
+
+  void noteOverrun(long long frames, bool fromTimeline); // record frames lost; may be called from the capture thread
+  void reportOverruns();              // send a devOverrun event for any not yet announced; main thread only
 
   virtual int getNumPollFDs ();
   virtual int hw_getNumPollFDs () = 0;
@@ -96,10 +177,34 @@ public:
   // also returns CLOCK_REALTIME for first frame in frameTimestamp
   // negative return value is an error code.
 
+  virtual int hw_getWideFrames (int32_t *buf, int numFrames, double & frameTimestamp) {return -ENOSYS;};
+  // like hw_getFrames, but for wide devices, which deliver S32 samples; only those need implement it
+
+  virtual int hw_peekFrames (const int16_t * & frames, int numFrames, double & frameTimestamp) {return -ENOSYS;};
+  // like hw_getFrames, but instead of copying, point frames at up to numFrames interleaved frames in the hardware's
+  // own buffer, which stay valid until hw_releaseFrames is called.  Returns -ENOSYS if not supported (the default).
+  virtual const char * hw_formatName () {return "S16_LE";}; // sample format the hardware delivers; it's converted to S16_LE or (if wide) S32_LE as frames are read
+  virtual int hw_periodFrames () {return 0;};  // hardware frames per period, as negotiated with the device; 0 if it has no fixed period
+  virtual int hw_bufferFrames () {return 0;};  // hardware frames the device can buffer before overrunning, as negotiated; 0 if unknown
+
+  virtual void hw_releaseFrames () {};  // give frames from the last successful hw_peekFrames back to the hardware
+
+  virtual bool hw_sweepable () {return false;}; // can hw_availNow be used instead of polling this device's fds?
+  virtual int hw_availNow () {return 0;};  // like hw_handleEvents, but without a poll() result; for sweeps
+
+  virtual bool hw_threadable () {return true;}; // can this device be read by a capture thread?
+
+  bool sweep(double timeNow);         // if read by a SweepTimer, process all frames the device has now; returns true if there were any
+
   int start(double timeNow);
   void stop(double timeNow);
   void setDemodFMForRaw(bool demod);
 
+  void processFrames(const int16_t * frames, int avail, double frameTimestamp); // downsample and distribute avail frames to raw listeners and plugins
+  void processFrames(const int32_t * frames, int avail, double frameTimestamp); // the same, for wide devices
+
+  int addChannelDev(int numChannels, int k, const string & devLabel); // feed channel k of numChannels to the device devLabel; returns 0 on success
+
 protected:
 
   DevMinder(const string &devName, int rate, unsigned int numChan, unsigned int maxSampleAbs, const string &label, double now, int buffSize); // buffSize is in frames.
@@ -111,10 +216,33 @@ protected:
   int do_restart(double timeNow);
   virtual int hw_do_restart() = 0;    // returns 0 on success; non-zero otherwise
 
-  virtual int hw_do_stop() = 0;       // returns 0 on success; non-zero otherwise
+  virtual int hw_do_stop() = 0;       // returns 0 on success; non-zero otherwise; may leave the hardware open for a quick restart
+  virtual void hw_close() {};         // release the hardware entirely, so the next start reopens it from scratch
 
   virtual bool hw_running(double timeNow) = 0;      // is device running?
 
+  void checkForStall(double timeNow); // restart device if it has delivered no data for too long
+  template < typename T >
+  void processFramesAs(const T * frames, int avail, double frameTimestamp); // either processFrames
+  void distribute(double frameTimestamp, uint64_t decimTime); // hand the streams decim has just computed to their consumers
+  template < typename T >
+  void channelize(const T * frames, int avail, double frameTimestamp); // feed a block of frames to channelDevs
+  void deviceError(int err);          // report a (negative) hardware error code and restart the device; main thread only
+  void readFrames(int avail, double timeNow); // read and process avail frames, as returned by hw_handleEvents or hw_availNow
+  template < typename T >
+  void copyFrames(std::vector < T > & buf, int avail, double timeNow); // read avail frames into buf, then process them
+  int getFrames(int16_t *buf, int numFrames, double & frameTimestamp) {return hw_getFrames(buf, numFrames, frameTimestamp);};
+  int getFrames(int32_t *buf, int numFrames, double & frameTimestamp) {return hw_getWideFrames(buf, numFrames, frameTimestamp);};
+  bool consumersBacklogged();         // would some plugin or raw listener drop data if given more now?  Main thread only.
+  bool swept();                       // is this device read by a SweepTimer?
+
+  void startCaptureThread();          // if useCaptureThreads, start reading hardware on a separate thread
+  void stopCaptureThread();           // stop and join any capture thread; discards any frames it queued
+  void handleCaptureEvents(bool timedOut, double timeNow); // consume blocks queued by capture thread, and handle its quitting on an error
+  void queueCaptureBlock(int frames, double timestamp); // called from capture thread; negative frames is an error code, after which the thread quits
+
+  static void captureLoop(DevMinder *dev); // body of capture thread
+
 };
 
 #endif // DEVMINDER_HPP
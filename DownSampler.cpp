@@ -0,0 +1,460 @@
+#include "DownSampler.hpp"
+#include <string.h>
+#include <math.h>
+#include <limits>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DOWNSAMPLER_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DOWNSAMPLER_SSE2
+#endif
+
+/*
+  for each sample type T, the type windows of T are summed in, which
+  is also the signed type of T's CIC registers
+*/
+
+template < typename T > struct Wider;
+template <> struct Wider < int16_t > { typedef int32_t Sum; };
+template <> struct Wider < int32_t > { typedef int64_t Sum; };
+
+/*
+  sum n consecutive frames of interleaved mono or stereo S16 samples
+  into s[0] (and s[1]).  The vector loops keep one int32 accumulator
+  lane per channel per position; stereo frames are split into left
+  and right lanes in-register.  Integer addition is exact, so the
+  result doesn't depend on the order of summation.
+*/
+
+static inline void
+sumFrames1(const int16_t *p, int n, int32_t *s) {
+  int32_t sum = 0;
+  int i = 0;
+#if defined(DOWNSAMPLER_NEON)
+  int32x4_t a = vdupq_n_s32(0);
+  for (; i + 8 <= n; i += 8, p += 8)
+    a = vpadalq_s16(a, vld1q_s16(p));
+  int32x2_t h = vadd_s32(vget_low_s32(a), vget_high_s32(a));
+  sum = vget_lane_s32(vpadd_s32(h, h), 0);
+#elif defined(DOWNSAMPLER_SSE2)
+  __m128i a = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  for (; i + 8 <= n; i += 8, p += 8)
+    a = _mm_add_epi32(a, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) p), ones));
+  a = _mm_add_epi32(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)));
+  a = _mm_add_epi32(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)));
+  sum = _mm_cvtsi128_si32(a);
+#endif
+  for (; i < n; ++i)
+    sum += *p++;
+  s[0] = sum;
+};
+
+static inline void
+sumFrames2(const int16_t *p, int n, int32_t *s) {
+  int32_t sum0 = 0, sum1 = 0;
+  int i = 0;
+#if defined(DOWNSAMPLER_NEON)
+  int32x4_t a0 = vdupq_n_s32(0), a1 = vdupq_n_s32(0);
+  for (; i + 8 <= n; i += 8, p += 16) {
+    int16x8x2_t x = vld2q_s16(p); // deinterleave 8 frames into I and Q
+    a0 = vpadalq_s16(a0, x.val[0]);
+    a1 = vpadalq_s16(a1, x.val[1]);
+  }
+  int32x2_t h = vpadd_s32(vadd_s32(vget_low_s32(a0), vget_high_s32(a0)),
+                          vadd_s32(vget_low_s32(a1), vget_high_s32(a1)));
+  sum0 = vget_lane_s32(h, 0);
+  sum1 = vget_lane_s32(h, 1);
+#elif defined(DOWNSAMPLER_SSE2)
+  __m128i a0 = _mm_setzero_si128(), a1 = _mm_setzero_si128();
+  for (; i + 4 <= n; i += 4, p += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *) p);
+    // sign-extend even (first channel) and odd (second channel) int16 lanes to int32
+    a0 = _mm_add_epi32(a0, _mm_srai_epi32(_mm_slli_epi32(x, 16), 16));
+    a1 = _mm_add_epi32(a1, _mm_srai_epi32(x, 16));
+  }
+  a0 = _mm_add_epi32(a0, _mm_shuffle_epi32(a0, _MM_SHUFFLE(1, 0, 3, 2)));
+  a0 = _mm_add_epi32(a0, _mm_shuffle_epi32(a0, _MM_SHUFFLE(2, 3, 0, 1)));
+  a1 = _mm_add_epi32(a1, _mm_shuffle_epi32(a1, _MM_SHUFFLE(1, 0, 3, 2)));
+  a1 = _mm_add_epi32(a1, _mm_shuffle_epi32(a1, _MM_SHUFFLE(2, 3, 0, 1)));
+  sum0 = _mm_cvtsi128_si32(a0);
+  sum1 = _mm_cvtsi128_si32(a1);
+#endif
+  for (; i < n; ++i) {
+    sum0 += *p++;
+    sum1 += *p++;
+  }
+  s[0] = sum0;
+  s[1] = sum1;
+};
+
+/*
+  sum n consecutive frames of N interleaved channels into s[0..N-1];
+  N == 0 means nc channels, known only at run time.  With N fixed, the
+  channel loop is unrolled.
+*/
+
+template < int N, typename T, typename S >
+static inline void
+sumFrames(const T *p, int n, unsigned nc, S *s) {
+  const unsigned chans = N ? N : nc;
+  S sum[DownSampler::MAX_CHANNELS] = {0};
+  for (int i = 0; i < n; ++i, p += chans)
+    for (unsigned j = 0; j < chans; ++j)
+      sum[j] += p[j];
+  for (unsigned j = 0; j < chans; ++j)
+    s[j] = sum[j];
+};
+
+template <>
+inline void
+sumFrames < 1, int16_t, int32_t > (const int16_t *p, int n, unsigned /* nc */, int32_t *s) {
+  sumFrames1(p, n, s);
+};
+
+template <>
+inline void
+sumFrames < 2, int16_t, int32_t > (const int16_t *p, int n, unsigned /* nc */, int32_t *s) {
+  sumFrames2(p, n, s);
+};
+
+// round v to the nearest T, saturating
+template < typename T >
+static inline T
+roundSat(float v) {
+  v = roundf(v);
+  // compared as floats, so for int32_t the limits are +-2^31
+  if (v >= (float) std::numeric_limits < T >::max())
+    return std::numeric_limits < T >::max();
+  if (v <= (float) std::numeric_limits < T >::min())
+    return std::numeric_limits < T >::min();
+  return (T) v;
+};
+
+DownSampler::DownSampler() {
+  reset(1, DS_SUBSAMPLE, 1);
+};
+
+void
+DownSampler::reset(int factor, Mode mode, unsigned numChan) {
+  this->factor = factor;
+  this->mode = mode;
+  this->numChan = numChan;
+  for (int i=0; i < MAX_CHANNELS; ++i) {
+    accum[i] = 0;
+    count[i] = factor;
+  }
+  if (mode != DS_FIR || factor <= 1) {
+    taps.reset();
+    firHist.clear();
+    return;
+  }
+
+  // split factor so the FIR stage does as little of the decimation as
+  // possible while keeping the CIC's registers from overflowing
+
+  firFactor = 2;
+  while (factor % firFactor != 0 || factor / firFactor > MAX_CIC_FACTOR)
+    ++firFactor;
+  cicFactor = factor / firFactor;
+  cicCount = cicFactor;
+  firCount = firFactor;
+  memset(integ, 0, sizeof(integ));
+  memset(comb, 0, sizeof(comb));
+  memset(wideInteg, 0, sizeof(wideInteg));
+  memset(wideComb, 0, sizeof(wideComb));
+
+  boost::shared_ptr < FIRTaps > & cached = tapCache[factor];
+  if (! cached)
+    cached = designTaps(cicFactor, firFactor);
+  taps = cached;
+  firHist.assign(2 * taps->size() * numChan, 0.0f);
+  firPos = 0;
+};
+
+bool
+DownSampler::modeFromName(const std::string & name, Mode & mode) {
+  if (name == "sub")
+    mode = DS_SUBSAMPLE;
+  else if (name == "avg")
+    mode = DS_AVERAGE;
+  else if (name == "fir")
+    mode = DS_FIR;
+  else
+    return false;
+  return true;
+};
+
+const char *
+DownSampler::modeName(Mode mode) {
+  switch (mode) {
+  case DS_AVERAGE:
+    return "avg";
+  case DS_FIR:
+    return "fir";
+  default:
+    return "sub";
+  }
+};
+
+int
+DownSampler::process(const int16_t *in, int16_t *out, int frames) {
+  if (mode == DS_FIR && factor > 1)
+    return processFIR(in, out, frames, integ, comb);
+  return processAs(in, out, frames);
+};
+
+int
+DownSampler::process(const int32_t *in, int32_t *out, int frames) {
+  if (mode == DS_FIR && factor > 1)
+    return processFIR(in, out, frames, wideInteg, wideComb);
+  return processAs(in, out, frames);
+};
+
+template < typename T >
+int
+DownSampler::processAs(const T *in, T *out, int frames) {
+  if (factor <= 1) {
+    if (out != in)
+      memcpy(out, in, frames * numChan * sizeof(T));
+    return frames;
+  }
+
+  // the kernels below advance all channels together, which they always
+  // are unless the caller has fiddled with count[]
+  for (unsigned j = 1; j < numChan; ++j)
+    if (count[j] != count[0])
+      return processScalar(in, out, frames);
+
+  // use a kernel specialized for the number of channels, if there is one
+  switch (numChan) {
+  case 1:
+    return mode == DS_AVERAGE ? processAvg < 1 > (in, out, frames) : processSub < 1 > (in, out, frames);
+  case 2:
+    return mode == DS_AVERAGE ? processAvg < 2 > (in, out, frames) : processSub < 2 > (in, out, frames);
+  case 4:
+    return mode == DS_AVERAGE ? processAvg < 4 > (in, out, frames) : processSub < 4 > (in, out, frames);
+  case 8:
+    return mode == DS_AVERAGE ? processAvg < 8 > (in, out, frames) : processSub < 8 > (in, out, frames);
+  default:
+    return mode == DS_AVERAGE ? processAvg < 0 > (in, out, frames) : processSub < 0 > (in, out, frames);
+  }
+};
+
+template < int N, typename T >
+int
+DownSampler::processAvg(const T *in, T *out, int frames) {
+  // sum each window of factor frames with a vector kernel, then do the
+  // (inherently serial) rounding and remainder carry once per output frame.
+  // The window in progress at the end of one call is finished by the next.
+
+  const unsigned chans = N ? N : numChan;
+  const T * rs = in;
+  T * ds = out;
+  int need = count[0];
+  int numOut = 0;
+  typename Wider < T >::Sum s[MAX_CHANNELS];
+
+  while (frames >= need) {
+    sumFrames < N > (rs, need, chans, s);
+    rs += need * chans;
+    frames -= need;
+    for (unsigned j = 0; j < chans; ++j) {
+      accum[j] += s[j];
+      // simple dithering: round to nearest int, but retain remainder in accum
+      T downSample = (accum[j] + factor / 2) / factor;
+      ds[j] = downSample;
+      accum[j] -= (int64_t) downSample * factor;
+    }
+    ds += chans;
+    ++numOut;
+    need = factor;
+  }
+  if (frames > 0) {
+    sumFrames < N > (rs, frames, chans, s);
+    for (unsigned j = 0; j < chans; ++j)
+      accum[j] += s[j];
+    need -= frames;
+  }
+  for (unsigned j = 0; j < chans; ++j)
+    count[j] = need;
+  return numOut;
+};
+
+template < int N, typename T >
+int
+DownSampler::processSub(const T *in, T *out, int frames) {
+  // jump straight to each kept frame and move it as a unit, so the cost
+  // is per output frame rather than per input sample.  With N fixed,
+  // the memcpy is a fixed-size move.
+
+  const unsigned chans = N ? N : numChan;
+  int i = count[0] - 1;
+  int numOut = 0;
+  for (; i < frames; i += factor)
+    memmove(out + chans * numOut++, in + chans * i, chans * sizeof(T));
+  for (unsigned j = 0; j < chans; ++j)
+    count[j] = i - frames + 1;
+  return numOut;
+};
+
+template < typename T >
+int
+DownSampler::processScalar(const T *in, T *out, int frames) {
+  int downSampleAvail = frames;
+  for (unsigned j = 0; j < numChan; ++j) {
+    downSampleAvail = 0; // works the same for all channels
+    const T * rs = & in[j];
+    T * ds = & out[j];
+    if (mode == DS_AVERAGE) {
+      for (int i=0; i < frames; ++i) {
+        accum[j] += *rs;
+        rs += numChan;
+        if (! --count[j]) {
+          count[j] = factor;
+          // simple dithering: round to nearest int, but retain remainder in accum
+          T downSample = (accum[j] + factor / 2) / factor;
+          *ds = downSample;
+          accum[j] -= (int64_t) downSample * factor;
+          ds += numChan;
+          ++ downSampleAvail;
+        }
+      }
+    } else {
+      for (int i=0; i < frames; ++i) {
+        if (! --count[j]) {
+          count[j] = factor;
+          *ds = *rs;
+          ds += numChan;
+          ++ downSampleAvail;
+        }
+        rs += numChan;
+      }
+    }
+  }
+  return downSampleAvail;
+};
+
+template < typename T, typename R >
+int
+DownSampler::processFIR(const T *in, T *out, int frames, R integ[][CIC_ORDER], R comb[][CIC_ORDER]) {
+  // Each output frame is written no later than the input frame
+  // which completes it, so this works in place.
+
+  typedef typename Wider < T >::Sum SR; // signed register type
+  const T * rs = in;
+  T * ds = out;
+  int numOut = 0;
+
+  for (int i = 0; i < frames; ++i, rs += numChan) {
+    if (cicFactor > 1) {
+      for (unsigned j = 0; j < numChan; ++j) {
+        R * in = integ[j];
+        in[0] += (R) (SR) rs[j];
+        for (int k = 1; k < CIC_ORDER; ++k)
+          in[k] += in[k - 1];
+      }
+      if (--cicCount)
+        continue;
+      cicCount = cicFactor;
+      for (unsigned j = 0; j < numChan; ++j) {
+        R v = integ[j][CIC_ORDER - 1];
+        for (int k = 0; k < CIC_ORDER; ++k) {
+          R prev = comb[j][k];
+          comb[j][k] = v;
+          v -= prev;
+        }
+        pushFIR(j, (float) (SR) v);
+      }
+    } else {
+      for (unsigned j = 0; j < numChan; ++j)
+        pushFIR(j, rs[j]);
+    }
+    if (++firPos == (int) taps->size())
+      firPos = 0;
+    if (--firCount)
+      continue;
+    firCount = firFactor;
+    for (unsigned j = 0; j < numChan; ++j)
+      ds[j] = roundSat < T > (outputFIR(j));
+    ds += numChan;
+    ++numOut;
+  }
+  return numOut;
+};
+
+void
+DownSampler::pushFIR(unsigned chan, float x) {
+  // the newest value is stored at firPos and firPos + len, so the len
+  // values ending there are always contiguous
+  int len = taps->size();
+  float * h = & firHist[2 * len * chan];
+  h[firPos] = h[firPos + len] = x;
+};
+
+float
+DownSampler::outputFIR(unsigned chan) {
+  // firPos has already been advanced past the newest value, so the
+  // delay line, oldest first, starts at firPos
+  int len = taps->size();
+  const float * h = & firHist[2 * len * chan + firPos];
+  const float * t = & (*taps)[0];
+  float y = 0;
+  for (int k = 0; k < len; ++k)
+    y += h[k] * t[k];
+  return y;
+};
+
+double
+DownSampler::besselI0(double x) {
+  // zeroth order modified Bessel function of the first kind, by power series
+  double sum = 1, term = 1;
+  for (int k = 1; k < 50; ++k) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+    if (term < 1e-12 * sum)
+      break;
+  }
+  return sum;
+};
+
+boost::shared_ptr < FIRTaps >
+DownSampler::designTaps(int cicFactor, int firFactor) {
+  // Kaiser-windowed lowpass, stored oldest-input-first, with cutoff
+  // midway between 0.4 and 0.5 of the output rate, and a passband
+  // shaped to undo the droop of the CIC stage.  Frequencies are in
+  // cycles per CIC output sample.  The CIC's DC gain of
+  // cicFactor^CIC_ORDER is divided out here too.
+
+  const int len = firFactor * FIR_TAPS_PER_PHASE;
+  const double cutoff = 0.45 / firFactor;
+  const int GRID = 512;
+  const double beta = 6.0;
+
+  boost::shared_ptr < FIRTaps > taps (new FIRTaps(len));
+  double centre = (len - 1) / 2.0;
+  double sum = 0;
+  std::vector < double > h(len);
+  for (int n = 0; n < len; ++n) {
+    // inverse cosine transform of the desired response, by the midpoint rule
+    double acc = 0;
+    for (int g = 0; g < GRID; ++g) {
+      double f = (g + 0.5) * cutoff / GRID;
+      double droop = 1;
+      if (cicFactor > 1)
+        droop = pow(sin(M_PI * f) / (cicFactor * sin(M_PI * f / cicFactor)), CIC_ORDER);
+      acc += cos(2 * M_PI * f * (n - centre)) / droop;
+    }
+    double r = 2 * (n - centre) / (len - 1);
+    h[n] = acc * besselI0(beta * sqrt(1 - r * r)) / besselI0(beta);
+    sum += h[n];
+  }
+  double gain = sum * pow((double) cicFactor, CIC_ORDER);
+  for (int n = 0; n < len; ++n)
+    (*taps)[n] = h[n] / gain;
+  return taps;
+};
+
+std::map < int, boost::shared_ptr < FIRTaps > > DownSampler::tapCache;
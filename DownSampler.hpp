@@ -0,0 +1,91 @@
+#ifndef DOWNSAMPLER_HPP
+#define DOWNSAMPLER_HPP
+
+/*
+  Integer-factor downsampling of interleaved S16 or S32 frames, by
+  one of:
+
+  - subsampling: keep every factor'th frame
+  - averaging: boxcar average, with the rounding remainder carried
+    forward as simple dithering
+  - fir: a CIC front stage decimating by most of the factor, followed
+    by a polyphase FIR stage which decimates by the rest and
+    compensates for the CIC passband droop.  This is much closer to
+    alias-free than averaging.
+
+  State is carried across calls, so a stream can be fed in blocks of
+  any size.  Output can overwrite the input.
+
+  The averaging and subsampling kernels are specialized for 1, 2, 4, and
+  8 channels, and use NEON or SSE2 when available for S16 with 1 and 2;
+  results are bit-identical to the plain per-sample loops.  S32 frames
+  are summed in 64 bits, so averaging them can't overflow.
+*/
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/shared_ptr.hpp>
+
+typedef std::vector < float > FIRTaps;
+
+class DownSampler {
+
+public:
+  typedef enum {DS_SUBSAMPLE, DS_AVERAGE, DS_FIR} Mode;
+
+  static const int  MAX_CHANNELS = 8;   // maximum number of interleaved channels
+  static const int  CIC_ORDER = 3;      // number of integrator and comb stages in CIC
+  static const int  MAX_CIC_FACTOR = 32; // keeps CIC register growth (CIC_ORDER * log2(factor) bits) within 32 bits for S16 input,
+                                         // and within 64 bits for S32 input
+  static const int  FIR_TAPS_PER_PHASE = 16; // FIR length is this times the FIR decimation factor
+
+  int16_t           factor;             // downsampling factor; 1 means no downsampling
+  Mode              mode;               // how to downsample
+  unsigned          numChan;            // number of interleaved channels
+  int16_t           count[MAX_CHANNELS];  // count of input frames remaining until next output frame
+  int64_t           accum[MAX_CHANNELS];  // accumulator for averaging
+
+  DownSampler();
+
+  void reset(int factor, Mode mode, unsigned numChan); // set parameters and clear state
+
+  int process(const int16_t *in, int16_t *out, int frames); // downsample frames from in to out, which may be the same; returns number of output frames
+  int process(const int32_t *in, int32_t *out, int frames); // the same, for S32 frames
+  int process(int16_t *buf, int frames) {return process(buf, buf, frames);}; // downsample in place
+
+  static bool modeFromName(const std::string & name, Mode & mode); // parse "sub", "avg", or "fir"; returns false if invalid
+  static const char * modeName(Mode mode);
+
+  static double besselI0(double x);    // zeroth order modified Bessel function of the first kind, for Kaiser windows
+
+protected:
+  // state for DS_FIR mode
+  int               cicFactor;          // decimation factor of CIC stage
+  int               firFactor;          // decimation factor of FIR stage
+  int               cicCount;           // input frames remaining until next CIC output
+  int               firCount;           // CIC outputs remaining until next FIR output
+  uint32_t          integ[MAX_CHANNELS][CIC_ORDER]; // CIC integrators; wrap-around arithmetic is intended
+  uint32_t          comb[MAX_CHANNELS][CIC_ORDER];  // CIC comb delays
+  uint64_t          wideInteg[MAX_CHANNELS][CIC_ORDER]; // the same, for S32 input
+  uint64_t          wideComb[MAX_CHANNELS][CIC_ORDER];
+  boost::shared_ptr < FIRTaps > taps;   // FIR taps, including CIC gain and droop compensation
+  std::vector < float > firHist;        // FIR delay line for each channel, stored twice so the newest taps->size() values are contiguous
+  int               firPos;             // index in delay line of oldest value
+
+  static std::map < int, boost::shared_ptr < FIRTaps > > tapCache; // taps for each factor, shared among DownSamplers
+
+  template < typename T > int processAs(const T *in, T *out, int frames); // either process
+  template < int N, typename T > int processAvg(const T *in, T *out, int frames); // N channels; 0 means numChan
+  template < int N, typename T > int processSub(const T *in, T *out, int frames);
+  template < typename T > int processScalar(const T *in, T *out, int frames); // per-channel loops, for channels out of step
+  template < typename T, typename R > int processFIR(const T *in, T *out, int frames, R integ[][CIC_ORDER], R comb[][CIC_ORDER]); // R is the CIC register type
+
+  void pushFIR(unsigned chan, float x);   // add a CIC output to a channel's FIR delay line
+  float outputFIR(unsigned chan);         // filter a channel's delay line
+
+  static boost::shared_ptr < FIRTaps > designTaps(int cicFactor, int firFactor);
+};
+
+#endif // DOWNSAMPLER_HPP
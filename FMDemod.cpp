@@ -0,0 +1,220 @@
+#include "FMDemod.hpp"
+#include <math.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FMDEMOD_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FMDEMOD_SSE2
+#endif
+
+// minimax coefficients for atan(a) = a * P(a^2) on [0, 1]; max error ~2e-6 rad
+
+static const float ATAN_C1 =  0.99997726f;
+static const float ATAN_C3 = -0.33262347f;
+static const float ATAN_C5 =  0.19354346f;
+static const float ATAN_C7 = -0.11643287f;
+static const float ATAN_C9 =  0.05265332f;
+static const float ATAN_C11 = -0.01172120f;
+
+static const float FLT_PI = 3.14159265358979f;
+static const float FLT_PI_2 = 1.57079632679490f;
+static const float TINY = 1e-30f;  // avoids 0/0 when both samples are zero
+
+FMDemod::FMDemod() {
+  reset();
+};
+
+void
+FMDemod::reset() {
+  lastRe = 1;
+  lastIm = 0;
+};
+
+float
+FMDemod::atan2(float y, float x) {
+  // reduce to the first octant, approximate there, then reflect back
+  float ax = fabsf(x), ay = fabsf(y);
+  float mn = ax < ay ? ax : ay;
+  float mx = ax < ay ? ay : ax;
+  float a = mn / (mx > TINY ? mx : TINY);
+  float s = a * a;
+  float r = a * (ATAN_C1 + s * (ATAN_C3 + s * (ATAN_C5 + s * (ATAN_C7 + s * (ATAN_C9 + s * ATAN_C11)))));
+  if (ay > ax)
+    r = FLT_PI_2 - r;
+  if (x < 0)
+    r = FLT_PI - r;
+  return y < 0 ? -r : r;
+};
+
+static inline int16_t
+roundSat(float v) {
+  v = roundf(v);
+  if (v > 32767)
+    return 32767;
+  if (v < -32768)
+    return -32768;
+  return (int16_t) v;
+};
+
+/*
+  load 4 frames of interleaved I/Q from p into vectors of their real
+  and imaginary parts, as floats
+*/
+
+#if defined(FMDEMOD_NEON)
+static inline void
+load4(const int16_t *p, float32x4_t & re, float32x4_t & im) {
+  int16x4x2_t v = vld2_s16(p);     // deinterleave: val[0] = im, val[1] = re
+  im = vcvtq_f32_s32(vmovl_s16(v.val[0]));
+  re = vcvtq_f32_s32(vmovl_s16(v.val[1]));
+};
+
+static inline void
+load4(const int32_t *p, float32x4_t & re, float32x4_t & im) {
+  int32x4x2_t v = vld2q_s32(p);
+  im = vcvtq_f32_s32(v.val[0]);
+  re = vcvtq_f32_s32(v.val[1]);
+};
+
+#elif defined(FMDEMOD_SSE2)
+static inline void
+load4(const int16_t *p, __m128 & re, __m128 & im) {
+  __m128i v = _mm_loadu_si128((const __m128i *) p);
+  // deinterleave by sign-extending even (im) and odd (re) int16 lanes
+  im = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16));
+  re = _mm_cvtepi32_ps(_mm_srai_epi32(v, 16));
+};
+
+static inline void
+load4(const int32_t *p, __m128 & re, __m128 & im) {
+  __m128 a = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) p));       // im0 re0 im1 re1
+  __m128 b = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) (p + 4))); // im2 re2 im3 re3
+  im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+  re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+};
+#endif
+
+void
+FMDemod::process(const int16_t *iq, int16_t *out, int n, float scale) {
+  processAs(iq, out, n, scale);
+};
+
+void
+FMDemod::process(const int32_t *iq, int16_t *out, int n, float scale) {
+  processAs(iq, out, n, scale);
+};
+
+template < typename T >
+void
+FMDemod::processAs(const T *iq, int16_t *out, int n, float scale) {
+  // Each vector iteration reads 4 frames before writing 4 outputs, and
+  // output i is never beyond input frame i, so this works in place.
+
+  int i = 0;
+
+#if defined(FMDEMOD_NEON)
+  const float32x4_t c1 = vdupq_n_f32(ATAN_C1), c3 = vdupq_n_f32(ATAN_C3), c5 = vdupq_n_f32(ATAN_C5);
+  const float32x4_t c7 = vdupq_n_f32(ATAN_C7), c9 = vdupq_n_f32(ATAN_C9), c11 = vdupq_n_f32(ATAN_C11);
+  const float32x4_t pi = vdupq_n_f32(FLT_PI), pi_2 = vdupq_n_f32(FLT_PI_2);
+  const float32x4_t tiny = vdupq_n_f32(TINY), vscale = vdupq_n_f32(scale);
+  const uint32x4_t signBit = vdupq_n_u32(0x80000000);
+  const uint32x4_t half = vreinterpretq_u32_f32(vdupq_n_f32(0.5f));
+  float32x4_t pre = vdupq_n_f32(lastRe), pim = vdupq_n_f32(lastIm);
+
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t re, im;
+    load4(iq + 2 * i, re, im);
+    // previous samples: last lane of previous block, then first 3 lanes of this one
+    float32x4_t re0 = vextq_f32(pre, re, 3);
+    float32x4_t im0 = vextq_f32(pim, im, 3);
+    pre = re;
+    pim = im;
+
+    // d = z * conj(z0)
+    float32x4_t dre = vmlaq_f32(vmulq_f32(re, re0), im, im0);
+    float32x4_t dim = vmlsq_f32(vmulq_f32(im, re0), re, im0);
+
+    float32x4_t ax = vabsq_f32(dre), ay = vabsq_f32(dim);
+    float32x4_t mn = vminq_f32(ax, ay), mx = vmaxq_f32(vmaxq_f32(ax, ay), tiny);
+    // a = mn / mx, via reciprocal estimate and two Newton-Raphson steps (ARMv7 NEON has no divide)
+    float32x4_t rcp = vrecpeq_f32(mx);
+    rcp = vmulq_f32(rcp, vrecpsq_f32(mx, rcp));
+    rcp = vmulq_f32(rcp, vrecpsq_f32(mx, rcp));
+    float32x4_t a = vmulq_f32(mn, rcp);
+    float32x4_t s = vmulq_f32(a, a);
+    float32x4_t p = vmlaq_f32(c9, s, c11);
+    p = vmlaq_f32(c7, s, p);
+    p = vmlaq_f32(c5, s, p);
+    p = vmlaq_f32(c3, s, p);
+    p = vmlaq_f32(c1, s, p);
+    float32x4_t r = vmulq_f32(a, p);
+    r = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(pi_2, r), r);
+    r = vbslq_f32(vcltq_f32(dre, vdupq_n_f32(0)), vsubq_f32(pi, r), r);
+    // copy sign of dim onto r
+    r = vreinterpretq_f32_u32(vorrq_u32(vbicq_u32(vreinterpretq_u32_f32(r), signBit),
+                                        vandq_u32(vreinterpretq_u32_f32(dim), signBit)));
+
+    // scale, round half away from zero, and saturate to int16
+    float32x4_t y = vmulq_f32(r, vscale);
+    float32x4_t h = vreinterpretq_f32_u32(vorrq_u32(half, vandq_u32(vreinterpretq_u32_f32(y), signBit)));
+    vst1_s16(out + i, vqmovn_s32(vcvtq_s32_f32(vaddq_f32(y, h))));
+  }
+  lastRe = vgetq_lane_f32(pre, 3);
+  lastIm = vgetq_lane_f32(pim, 3);
+
+#elif defined(FMDEMOD_SSE2)
+  const __m128 c1 = _mm_set1_ps(ATAN_C1), c3 = _mm_set1_ps(ATAN_C3), c5 = _mm_set1_ps(ATAN_C5);
+  const __m128 c7 = _mm_set1_ps(ATAN_C7), c9 = _mm_set1_ps(ATAN_C9), c11 = _mm_set1_ps(ATAN_C11);
+  const __m128 pi = _mm_set1_ps(FLT_PI), pi_2 = _mm_set1_ps(FLT_PI_2);
+  const __m128 tiny = _mm_set1_ps(TINY), vscale = _mm_set1_ps(scale);
+  const __m128 signBit = _mm_set1_ps(-0.0f);
+  __m128 pre = _mm_set1_ps(lastRe), pim = _mm_set1_ps(lastIm);
+
+  for (; i + 4 <= n; i += 4) {
+    __m128 re, im;
+    load4(iq + 2 * i, re, im);
+    // previous samples: last lane of previous block, then first 3 lanes of this one
+    __m128 re0 = _mm_shuffle_ps(_mm_shuffle_ps(pre, re, _MM_SHUFFLE(0, 0, 3, 3)), re, _MM_SHUFFLE(2, 1, 2, 0));
+    __m128 im0 = _mm_shuffle_ps(_mm_shuffle_ps(pim, im, _MM_SHUFFLE(0, 0, 3, 3)), im, _MM_SHUFFLE(2, 1, 2, 0));
+    pre = re;
+    pim = im;
+
+    // d = z * conj(z0)
+    __m128 dre = _mm_add_ps(_mm_mul_ps(re, re0), _mm_mul_ps(im, im0));
+    __m128 dim = _mm_sub_ps(_mm_mul_ps(im, re0), _mm_mul_ps(re, im0));
+
+    __m128 ax = _mm_andnot_ps(signBit, dre), ay = _mm_andnot_ps(signBit, dim);
+    __m128 mn = _mm_min_ps(ax, ay), mx = _mm_max_ps(_mm_max_ps(ax, ay), tiny);
+    __m128 a = _mm_div_ps(mn, mx);
+    __m128 s = _mm_mul_ps(a, a);
+    __m128 p = _mm_add_ps(c9, _mm_mul_ps(s, c11));
+    p = _mm_add_ps(c7, _mm_mul_ps(s, p));
+    p = _mm_add_ps(c5, _mm_mul_ps(s, p));
+    p = _mm_add_ps(c3, _mm_mul_ps(s, p));
+    p = _mm_add_ps(c1, _mm_mul_ps(s, p));
+    __m128 r = _mm_mul_ps(a, p);
+    __m128 m = _mm_cmpgt_ps(ay, ax);
+    r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(pi_2, r)), _mm_andnot_ps(m, r));
+    m = _mm_cmplt_ps(dre, _mm_setzero_ps());
+    r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(pi, r)), _mm_andnot_ps(m, r));
+    r = _mm_or_ps(r, _mm_and_ps(dim, signBit));
+
+    // scale, round to nearest, and saturate to int16
+    __m128i y = _mm_cvtps_epi32(_mm_mul_ps(r, vscale));
+    _mm_storel_epi64((__m128i *) (out + i), _mm_packs_epi32(y, y));
+  }
+  _mm_store_ss(& lastRe, _mm_shuffle_ps(pre, pre, _MM_SHUFFLE(3, 3, 3, 3)));
+  _mm_store_ss(& lastIm, _mm_shuffle_ps(pim, pim, _MM_SHUFFLE(3, 3, 3, 3)));
+#endif
+
+  for (; i < n; ++i) {
+    float im = iq[2 * i], re = iq[2 * i + 1];
+    float dre = re * lastRe + im * lastIm;
+    float dim = im * lastRe - re * lastIm;
+    lastRe = re;
+    lastIm = im;
+    out[i] = roundSat(scale * atan2(dim, dre));
+  }
+};
@@ -0,0 +1,43 @@
+#ifndef FMDEMOD_HPP
+#define FMDEMOD_HPP
+
+/*
+  FM discriminator for interleaved S16 or S32 I/Q samples.
+
+  The phase change between consecutive samples is taken as
+  arg(z[n] * conj(z[n-1])), which needs no unwrapping, and the
+  arctangent is a polynomial approximation with maximum error about
+  2e-6 radians.  Four samples are handled per vector instruction with
+  NEON or SSE2.  The previous sample is kept, so a stream can be fed in
+  blocks of any size.
+
+  As in the original atan2f code, the first channel of each frame is
+  treated as the imaginary part, and the second as the real part.
+*/
+
+#include <stdint.h>
+
+class FMDemod {
+
+public:
+  FMDemod();
+
+  void reset();                 // forget the previous sample
+
+  // demodulate n frames of interleaved I/Q from iq into n mono samples in out,
+  // each being the phase change scaled by scale then rounded and saturated.
+  // out may be the same as iq.
+  void process(const int16_t *iq, int16_t *out, int n, float scale);
+  void process(const int32_t *iq, int16_t *out, int n, float scale); // the same, for S32 I/Q
+
+  static float atan2(float y, float x); // the scalar version of the approximation
+
+protected:
+  float             lastRe;     // real part of the previous sample
+  float             lastIm;     // imaginary part of the previous sample
+
+  template < typename T >
+  void processAs(const T *iq, int16_t *out, int n, float scale); // either process
+};
+
+#endif // FMDEMOD_HPP
@@ -0,0 +1,372 @@
+#include "FileMinder.hpp"
+#include "RTLSDRMinder.hpp"
+#include "U8Expand.hpp"
+#include "VampAlsaHost.hpp"
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <fstream>
+#include <iostream>
+
+void FileMinder::delete_privates() {
+  if (fileFD >= 0) {
+    close(fileFD);
+    fileFD = -1;
+  }
+  if (timerFD >= 0) {
+    close(timerFD);
+    timerFD = -1;
+  }
+  running = false;
+};
+
+int FileMinder::hw_open() {
+  if (reqBufferFrames > 0) {
+    std::cerr << "file devices don't accept a buffer size\n";
+    return 5;
+  }
+  fileFD = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fileFD < 0) {
+    std::cerr << "unable to open " << path << "\n";
+    return 1;
+  }
+  struct stat st;
+  fstat(fileFD, & st);
+  int rv = parseWav();
+  if (rv == 2) {
+    delete_privates();
+    return 2;
+  }
+  if (rv == 0 && reqFormat.length() > 0 && reqFormat != hw_formatName()) {
+    std::cerr << path << " is a .WAV file of " << hw_formatName() << " samples\n";
+    delete_privates();
+    return 3;
+  }
+  if (rv == 1) {
+    // raw samples, recorded at the rate we're asked for
+    if (reqFormat.length() == 0 || reqFormat == "S16_LE") {
+      setSampleBytes(2);
+    } else if (reqFormat == "S32_LE") {
+      setSampleBytes(4);
+    } else if (reqFormat == "U8") {
+      setSampleBytes(1);
+    } else {
+      std::cerr << "raw files must be S16_LE, S32_LE, or U8\n";
+      delete_privates();
+      return 3;
+    }
+    hwRate = rate;
+    dataOffset = 0;
+    fileFrames = st.st_size / frameBytes;
+  }
+  if (rate <= 0 || hwRate % rate != 0) { // we only do exact rate decimation
+    std::cerr << "rate " << hwRate << " of " << path << " is not a multiple of " << rate << "\n";
+    delete_privates();
+    return 4;
+  }
+  if (reqPeriodFrames > 0)
+    periodFrames = reqPeriodFrames;
+  else
+    periodFrames = std::max(1L, lround(hwRate / (reqWakeups > 0 ? reqWakeups : FILE_DEFAULT_WAKEUPS)));
+  firstTimestamp = findFirstTimestamp();
+
+  timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timerFD < 0) {
+    std::cerr << "unable to create timerfd for " << path << "\n";
+    delete_privates();
+    return 6;
+  }
+  // frameIndex is left alone, so if the file is being reopened (e.g.
+  // after a stall), the replay resumes where it left off
+  return 0;
+};
+
+int FileMinder::parseWav() {
+  // walk the RIFF chunks for "fmt " and "data"; anything else is skipped
+
+  char riff[12];
+  if (pread(fileFD, riff, sizeof(riff), 0) != sizeof(riff) || memcmp(riff, "RIFF", 4) || memcmp(riff + 8, "WAVE", 4))
+    return 1;
+  struct stat st;
+  fstat(fileFD, & st);
+
+  bool haveFmt = false;
+  off_t pos = sizeof(riff);
+  for (;;) {
+    char chunk[8];
+    uint32_t size;
+    if (pread(fileFD, chunk, sizeof(chunk), pos) != sizeof(chunk))
+      break;
+    memcpy(& size, chunk + 4, 4); // NB: assumes little-endian host, as does WavFileHeader
+    if (! memcmp(chunk, "fmt ", 4)) {
+      struct {
+        uint16_t fmtCode;
+        uint16_t numChan;
+        uint32_t sampleRate;
+        uint32_t byteRate;
+        uint16_t frameSize;
+        uint16_t sampleSize;
+      } __attribute__((packed)) fmt;
+      if (size < sizeof(fmt) || pread(fileFD, & fmt, sizeof(fmt), pos + 8) != sizeof(fmt))
+        break;
+      if (fmt.fmtCode != WavFileHeader::SAMPLE_FMT_CODE_PCM_S16_LE
+          || (fmt.sampleSize != WavFileHeader::BITS_PER_SAMPLE_S16_LE && fmt.sampleSize != WavFileHeader::BITS_PER_SAMPLE_S32_LE)) {
+        std::cerr << "only S16_LE and S32_LE .WAV files can be replayed\n";
+        return 2;
+      }
+      if (fmt.numChan != numChan) {
+        std::cerr << path << " has " << fmt.numChan << " channels, not " << numChan << "\n";
+        return 2;
+      }
+      hwRate = fmt.sampleRate;
+      setSampleBytes(fmt.sampleSize / 8);
+      haveFmt = true;
+    } else if (! memcmp(chunk, "data", 4) && haveFmt) {
+      dataOffset = pos + 8;
+      // a .WAV file written as a stream (e.g. by rawFile) has a placeholder
+      // size, so the file's own size is believed over the header's
+      long long bytes = std::min((long long) size, (long long) (st.st_size - dataOffset));
+      fileFrames = std::max(0LL, bytes / frameBytes);
+      return 0;
+    }
+    pos += 8 + (off_t) size + (size & 1);
+  }
+  std::cerr << path << " has no usable fmt and data chunks\n";
+  return 2;
+};
+
+double FileMinder::findFirstTimestamp() {
+  // a sidecar file wins
+  std::ifstream sidecar((path + ".ts").c_str());
+  double ts;
+  if (sidecar >> ts && ts > 0)
+    return ts;
+
+  // then a date and time in the file name, like the ones rawFile's path
+  // templates usually produce: YYYY-MM-DD?HH?MM?SS[.FFF], where each ? is
+  // any single non-digit
+  size_t slash = path.rfind('/');
+  std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+  for (size_t i = 0; i + 19 <= name.length(); ++i) {
+    const char * p = name.c_str() + i;
+    bool ok = true;
+    for (int j = 0; j < 19 && ok; ++j) {
+      bool sep = j == 4 || j == 7 || j == 10 || j == 13 || j == 16;
+      ok = sep ? (j < 10 ? p[j] == '-' : ! isdigit(p[j])) : isdigit(p[j]);
+    }
+    if (! ok)
+      continue;
+    struct tm t;
+    memset(& t, 0, sizeof(t));
+    t.tm_year = atoi(p) - 1900;
+    t.tm_mon  = atoi(p + 5) - 1;
+    t.tm_mday = atoi(p + 8);
+    t.tm_hour = atoi(p + 11);
+    t.tm_min  = atoi(p + 14);
+    t.tm_sec  = atoi(p + 17);
+    ts = timegm(& t);
+    if (p[19] == '.' && isdigit(p[20]))
+      ts += strtod(p + 19, 0);
+    return ts;
+  }
+
+  // otherwise, assume the file was last written as its last frame was recorded
+  struct stat st;
+  fstat(fileFD, & st);
+  return st.st_mtim.tv_sec + st.st_mtim.tv_nsec / 1.0e9 - (double) fileFrames / hwRate;
+};
+
+int FileMinder::armTimer(long long ns, bool periodic) {
+  struct itimerspec its;
+  memset(& its, 0, sizeof(its));
+  its.it_value.tv_sec = ns / 1000000000;
+  its.it_value.tv_nsec = ns % 1000000000;
+  if (periodic)
+    its.it_interval = its.it_value;
+  return timerfd_settime(timerFD, 0, & its, 0);
+};
+
+bool FileMinder::hw_is_open() {
+  return fileFD >= 0;
+};
+
+int FileMinder::hw_do_stop() {
+  // the file stays open; the next start resumes where this left off
+  running = false;
+  if (timerFD >= 0)
+    armTimer(0, false);
+  return 0;
+};
+
+void FileMinder::hw_close() {
+  delete_privates();
+};
+
+bool FileMinder::hw_running(double timeNow) {
+  return running;
+};
+
+int FileMinder::hw_do_start() {
+  if (fileFD < 0 && open())
+    return 1;
+  hasError = 0;
+  if (atEOF) {
+    frameIndex = 0;
+    atEOF = false;
+  }
+  startMono = VampAlsaHost::now(true);
+  startReal = VampAlsaHost::now();
+  startFrame = frameIndex;
+  running = true;
+  long long periodNS = std::max(1LL, (long long) periodFrames * 1000000000 / hwRate);
+  return armTimer(fast ? 1 : periodNS, ! fast) ? 1 : 0;
+}
+
+int FileMinder::hw_do_restart() {
+  hasError = 0;
+  return 0;
+};
+
+FileMinder::FileMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now):
+  DevMinder(devName, rate, numChan, 32767, label, now, 1),
+  fast(false),
+  fileFD(-1),
+  timerFD(-1),
+  dataOffset(0),
+  fileFrames(0),
+  frameBytes(2 * numChan),
+  periodFrames(0),
+  firstTimestamp(0),
+  running(false),
+  atEOF(false),
+  startMono(0),
+  startFrame(0),
+  startReal(0)
+{
+  if (devName.substr(0, 5) == "file:") {
+    path = devName.substr(5);
+  } else if (devName.substr(0, 9) == "filefast:") {
+    path = devName.substr(9);
+    fast = true;
+  } else {
+    throw std::runtime_error("Invalid name for file device; must look like 'file:PATH' or 'filefast:PATH'");
+  }
+};
+
+FileMinder::~FileMinder() {
+  delete_privates();
+};
+
+int FileMinder::hw_getNumPollFDs () {
+  return timerFD >= 0 && running ? 1 : 0;
+};
+
+int FileMinder::hw_getPollFDs (struct pollfd *pollfds) {
+  if (timerFD < 0)
+    return 1;
+
+  pollfds->fd = timerFD;
+  pollfds->events = POLLIN;
+  return 0;
+}
+
+int FileMinder::hw_handleEvents ( struct pollfd *pollfds, bool timedOut) {
+  if (timerFD < 0 || ! running || timedOut || ! (pollfds->revents & POLLIN))
+    return 0;
+  uint64_t expiries;
+  if (read(timerFD, & expiries, sizeof(expiries)) < 0 && errno != EAGAIN)
+    return -errno;
+
+  long long left = fileFrames - frameIndex;
+  if (left <= 0) {
+    finish();
+    return 0;
+  }
+  long long n;
+  if (fast) {
+    // a period per wakeup, unless some consumer is behind, in which case
+    // wait for it rather than have it drop data; either way, wake again soon
+    bool wait = consumersBacklogged();
+    if (wait) {
+      backlogWaits.add();
+      lastDataReceived = VampAlsaHost::now(); // waiting on purpose isn't a stall
+    }
+    armTimer(wait ? FILE_BACKLOG_WAIT_NS : 1, false);
+    n = wait ? 0 : periodFrames;
+  } else {
+    // whatever is due by now, so late or missed expiries don't change the
+    // replay rate, but catching up is spread over several expiries
+    n = llround((VampAlsaHost::now(true) - startMono) * hwRate) - (frameIndex - startFrame);
+    n = std::min(n, (long long) FILE_MAX_CATCHUP_PERIODS * periodFrames);
+  }
+  return std::max(0LL, std::min(n, left));
+};
+
+void FileMinder::setSampleBytes(int bytes) {
+  frameBytes = bytes * numChan;
+  wide = bytes == 4;
+  maxSampleAbs = bytes == 4 ? WIDE_MAX_SAMPLE_ABS : bytes == 2 ? 32767 : 128 * RTLSDRMinder::SAMPLE_SCALE;
+};
+
+int FileMinder::hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp) {
+  bool u8 = frameBytes == (int) numChan;
+  if (u8 && fileBuf.size() < (size_t) numFrames * frameBytes)
+    fileBuf.resize(numFrames * frameBytes);
+  int n = readFile(u8 ? (void *) & fileBuf[0] : (void *) buf, numFrames, frameTimestamp);
+  if (u8 && n > 0)
+    // scale up so sample downsampling using average method maintains more precision.
+    U8Expand::expand(& fileBuf[0], buf, n * numChan, RTLSDRMinder::SAMPLE_SCALE);
+  return n;
+};
+
+int FileMinder::hw_getWideFrames (int32_t *buf, int numFrames, double & frameTimestamp) {
+  // only S32_LE files are wide, and their samples are used as they are
+  return readFile(buf, numFrames, frameTimestamp);
+};
+
+int FileMinder::readFile(void *dst, int numFrames, double & frameTimestamp) {
+  long long n = std::min((long long) numFrames, fileFrames - frameIndex);
+  if (fileFD < 0 || n <= 0)
+    return 0;
+
+  ssize_t got = pread(fileFD, dst, n * frameBytes, dataOffset + (off_t) frameIndex * frameBytes);
+  if (got < 0)
+    return -errno;
+  n = got / frameBytes;
+  if (n == 0) {
+    // the file has shrunk since it was opened; end the replay here
+    fileFrames = frameIndex;
+    return 0;
+  }
+
+  frameTimestamp = firstTimestamp + (double) frameIndex / hwRate;
+  frameIndex += n;
+  return n;
+};
+
+void FileMinder::finish() {
+  double now = VampAlsaHost::now();
+  double wall = now - startReal;
+  double replayed = (double) (frameIndex - startFrame) / hwRate;
+  atEOF = true;
+  stop(now);
+
+  std::ostringstream msg;
+  msg << "\"event\":\"devEOF\",\"devLabel\":\"" << label << "\""
+      << ",\"frames\":" << frameIndex
+      << ",\"seconds\":" << (double) frameIndex / hwRate
+      << ",\"wallSeconds\":" << wall
+      << ",\"speed\":" << (wall > 0 ? replayed / wall : 0);
+  Pollable::asyncMsg(msg.str());
+};
+
+void FileMinder::addStatsFields(std::ostream & s) {
+  DevMinder::addStatsFields(s);
+  s << ",\"backlogWaits\":" << backlogWaits.get()
+    << ",\"fileFrames\":" << fileFrames
+    << ",\"filePos\":" << frameIndex;
+};
@@ -0,0 +1,103 @@
+#ifndef FILEMINDER_HPP
+#define FILEMINDER_HPP
+
+#include <string>
+#include <stdexcept>
+#include <sstream>
+#include <sys/types.h>
+
+using namespace std;
+
+#include "DevMinder.hpp"
+
+/*
+  A device replaying a recording, so that it passes through the same
+  downsampling, plugins, and raw listeners as live frames.  The device
+  name looks like 'file:PATH', to replay PATH at the rate it was
+  recorded, or 'filefast:PATH', to replay it as fast as its consumers
+  keep up.
+
+  PATH is a .WAV file of S16_LE or S32_LE samples (e.g. as written by
+  rawFile), or raw interleaved samples recorded at RATE: S16_LE by
+  default, or S32_LE or U8 (e.g. as written by rtl_sdr) with format=.
+  S32_LE files make a wide device.  The first frame's
+  timestamp comes from PATH.ts, if that holds seconds since the epoch;
+  otherwise from a date and time in PATH's file name, like
+  2024-05-01T12-34-56.789 (as UTC); otherwise from PATH's modification
+  time less its duration.
+
+  At the end of the file, the device stops and a devEOF event is sent.
+  A subsequent start replays the file from its beginning.
+*/
+
+class FileMinder : public DevMinder {
+
+protected:
+
+  std::string            path;        // recording to replay
+  bool                   fast;        // replay as fast as consumers keep up, rather than in real time?
+  int                    fileFD;      // fd for the recording; -1 means not open
+  int                    timerFD;     // timerfd pacing reads; -1 means not open
+  off_t                  dataOffset;  // byte offset of first frame in the file
+  long long              fileFrames;  // number of frames in the file
+  int                    frameBytes;  // bytes per frame in the file
+  int                    periodFrames;// frames read per timer expiry
+  double                 firstTimestamp; // timestamp of the file's first frame
+  bool                   running;     // has the replay been started and not stopped?
+  bool                   atEOF;       // has the whole file been replayed?
+  double                 startMono;   // CLOCK_MONOTONIC when the replay was (re)started
+  long long              startFrame;  // frameIndex at startMono
+  double                 startReal;   // CLOCK_REALTIME when the replay was (re)started, for the devEOF event
+  std::vector < unsigned char > fileBuf; // U8 samples as read, before expanding to S16_LE
+  StatCounter            backlogWaits;// timer expiries at which a fast replay waited for consumers to catch up
+
+public:
+
+  const static int FILE_DEFAULT_WAKEUPS = 10;  // periods per second, unless the open command gives period= or wakeups=
+  const static int FILE_MAX_CATCHUP_PERIODS = 4; // most periods read at one expiry when a real-time replay falls behind
+  const static int FILE_BACKLOG_WAIT_NS = 2000000; // how long a fast replay waits before rechecking backlogged consumers
+
+  virtual int hw_open();
+
+  virtual bool hw_is_open();
+
+  FileMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now);
+
+  ~FileMinder();
+
+  virtual int hw_getNumPollFDs ();
+
+  virtual int hw_getPollFDs (struct pollfd *pollfds);
+
+  virtual int hw_handleEvents ( struct pollfd *pollfds, bool timedOut);
+
+  virtual int hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp);
+
+  virtual int hw_getWideFrames (int32_t *buf, int numFrames, double & frameTimestamp);
+
+  virtual bool hw_threadable () {return false;}; // pacing depends on consumers' backlogs, which belong to the main thread
+
+  virtual int hw_periodFrames () {return periodFrames;};
+
+  virtual const char * hw_formatName () {return frameBytes == (int) numChan ? "U8" : wide ? "S32_LE" : "S16_LE";};
+
+protected:
+
+  virtual void delete_privates();
+  virtual int hw_do_start();
+  virtual int hw_do_stop();
+  virtual void hw_close();
+  virtual int hw_do_restart();
+  virtual bool hw_running(double timeNow);
+
+  void addStatsFields(std::ostream & s);
+
+  int parseWav();                     // find the format and data of a .WAV file; returns 0 on success, 1 if not a .WAV file, 2 if unusable
+  double findFirstTimestamp();        // timestamp of the file's first frame, from sidecar, file name, or mtime
+  int armTimer(long long ns, bool periodic); // (re)arm timerFD to expire in ns nanoseconds; 0 disarms it
+  void setSampleBytes(int bytes);     // set frameBytes, wide, and maxSampleAbs for 1 (U8), 2 (S16_LE), or 4 (S32_LE) byte samples
+  int readFile(void *dst, int numFrames, double & frameTimestamp); // read up to numFrames frames as they are in the file; like hw_getFrames
+  void finish();                      // stop at the end of the file, and announce it
+};
+
+#endif // FILEMINDER_HPP
@@ -0,0 +1,72 @@
+#include "MirroredRing.hpp"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+MirroredRing::MirroredRing() :
+  addr(0),
+  len(0)
+{
+};
+
+MirroredRing::~MirroredRing() {
+  release();
+};
+
+bool
+MirroredRing::allocate(size_t minBytes) {
+  release();
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t n = (minBytes + page - 1) / page * page;
+  if (n == 0)
+    n = page;
+
+  // get an fd for some anonymous shared memory
+  int fd = -1;
+#ifdef SYS_memfd_create
+  fd = syscall(SYS_memfd_create, "vamp-alsa-host-ring", 0);
+#endif
+  if (fd < 0) {
+    // older kernel: use an unlinked file in tmpfs
+    char name[] = "/dev/shm/vamp-alsa-host-ring-XXXXXX";
+    fd = mkstemp(name);
+    if (fd < 0)
+      return false;
+    unlink(name);
+  }
+  if (ftruncate(fd, n) < 0) {
+    close(fd);
+    return false;
+  }
+
+  // reserve address space for both copies, then map the same pages into each half
+
+  void * p = mmap(0, 2 * n, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  char * a = (char *) p;
+  if (mmap(a, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+      || mmap(a + n, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(p, 2 * n);
+    close(fd);
+    return false;
+  }
+  // the mappings keep the memory alive
+  close(fd);
+
+  addr = a;
+  len = n;
+  return true;
+};
+
+void
+MirroredRing::release() {
+  if (addr)
+    munmap(addr, 2 * len);
+  addr = 0;
+  len = 0;
+};
@@ -0,0 +1,36 @@
+#ifndef MIRROREDRING_HPP
+#define MIRROREDRING_HPP
+
+/*
+  A ring buffer whose pages are mapped twice, back to back, so that
+  any run of up to size() bytes starting in the first copy is
+  contiguous in memory.  Writes through either copy are seen in both.
+
+  Used for plugin input, where each block overlaps the previous one:
+  advancing the window is a pointer bump instead of a memmove.
+*/
+
+#include <stddef.h>
+
+class MirroredRing {
+
+public:
+  MirroredRing();
+  ~MirroredRing();
+
+  bool allocate(size_t minBytes); // map a ring of at least minBytes (rounded up to whole pages); false on failure
+  void release();
+
+  char * base() {return addr;};   // start of the first copy; base() + size() is the start of the second
+  size_t size() {return len;};
+
+protected:
+  char * addr;
+  size_t len;
+
+private:
+  MirroredRing(const MirroredRing &);             // not copyable
+  MirroredRing & operator=(const MirroredRing &);
+};
+
+#endif // MIRROREDRING_HPP
@@ -0,0 +1,40 @@
+#include "OutputBlock.hpp"
+#include <string.h>
+
+OutputBlock::Ptr
+OutputBlock::alloc(const char * p, uint32_t len) {
+  OutputBlock * b;
+  if (pool.empty()) {
+    b = new OutputBlock();
+    ++ allocated;
+  } else {
+    b = pool.back();
+    pool.pop_back();
+  }
+  // a recycled vector keeps its capacity, so steady-state blocks don't reallocate
+  b->bytes.resize(len);
+  if (len > 0)
+    memcpy(& b->bytes[0], p, len);
+  return Ptr(b);
+};
+
+void
+intrusive_ptr_add_ref(OutputBlock * b) {
+  ++ b->refs;
+};
+
+void
+intrusive_ptr_release(OutputBlock * b) {
+  if (-- b->refs > 0)
+    return;
+  if (OutputBlock::pool.size() < OutputBlock::MAX_POOLED_BLOCKS) {
+    OutputBlock::pool.push_back(b);
+  } else {
+    delete b;
+    -- OutputBlock::allocated;
+  }
+};
+
+// static initializers
+std::vector < OutputBlock * > OutputBlock::pool;
+unsigned OutputBlock::allocated = 0;
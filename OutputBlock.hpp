@@ -0,0 +1,51 @@
+#ifndef OUTPUTBLOCK_HPP
+#define OUTPUTBLOCK_HPP
+
+/*
+  A refcounted block of output bytes which can be queued to any number
+  of Pollables without copying.  Each Pollable keeps its own read cursor
+  into the blocks it has queued, and a block goes back to a free pool
+  once the last Pollable has written (or dropped) it.
+
+  Blocks are only created, queued, and released from the main (polling)
+  thread, so the reference count is not atomic.
+*/
+
+#include <vector>
+#include <stdint.h>
+#include <boost/intrusive_ptr.hpp>
+
+class OutputBlock;
+
+void intrusive_ptr_add_ref(OutputBlock * b);
+void intrusive_ptr_release(OutputBlock * b);
+
+class OutputBlock {
+
+public:
+  typedef boost::intrusive_ptr < OutputBlock > Ptr;
+
+  static const unsigned MAX_POOLED_BLOCKS = 256; // free blocks beyond this many are deleted
+
+  static Ptr alloc(const char * p, uint32_t len); // get a block from the pool, filled with a copy of len bytes at p
+
+  const char * data() const {return & bytes[0];};
+  uint32_t size() const {return bytes.size();};
+
+  static unsigned numAllocated() {return allocated;}; // total blocks in existence, pooled or not
+  static unsigned numPooled() {return pool.size();};  // blocks waiting in the pool
+
+protected:
+  OutputBlock() : refs(0) {};
+
+  std::vector < char > bytes;
+  int refs;
+
+  static std::vector < OutputBlock * > pool;
+  static unsigned allocated;
+
+  friend void intrusive_ptr_add_ref(OutputBlock * b);
+  friend void intrusive_ptr_release(OutputBlock * b);
+};
+
+#endif // OUTPUTBLOCK_HPP
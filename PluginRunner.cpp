@@ -1,14 +1,32 @@
 #include "PluginRunner.hpp"
+#include "PluginWorkerPool.hpp"
+#include "RTSched.hpp"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <iostream>
 
 void PluginRunner::delete_privates() {
   if (Pollable::terminating)
     return;
+  if (PluginWorkerPool::enabled()) {
+    boost::unique_lock < boost::mutex > lock(PluginWorkerPool::mutex);
+    PluginWorkerPool::cancel(this, lock);
+  }
+  for (std::vector < PluginBlock * >::iterator ib = freeBlocks.begin(); ib != freeBlocks.end(); ++ib)
+    delete *ib;
+  freeBlocks.clear();
+  if (featuresFD >= 0) {
+    close(featuresFD);
+    featuresFD = -1;
+  }
   if (plugin) {
     delete plugin;
   }
   if (plugbuf) {
     for (unsigned int i=0; i < numChan; ++i) {
-      if (plugbuf[i])
+      if (ringFrames)
+        rings[i].release();
+      else if (plugbuf[i])
         fftwf_free (plugbuf[i]);
     }
     delete [] plugbuf;
@@ -56,9 +74,37 @@ int PluginRunner::loadPlugin() {
   // allocate buffers to transfer float audio data to plugin
 
   plugbuf = new float*[numChan];
-  for (unsigned c = 0; c < numChan; ++c)
-    // use fftwf_alloc_real to make sure we have alignment suitable for in-place SIMD FFTs
-    plugbuf[c] =  fftwf_alloc_real(blockSize + 2);  // FIXME: is "+2" only to leave room for DFT?;
+
+  // if blocks overlap, use mirrored rings so that advancing by stepSize
+  // doesn't need a memmove.  Windows start on page boundaries plus
+  // multiples of stepSize floats, so only do this when that keeps the
+  // 16-byte alignment fftwf_alloc_real would give us.
+
+  if (stepSize < blockSize && stepSize % 4 == 0 && numChan <= (unsigned) MAX_NUM_CHAN) {
+    bool ok = true;
+    for (unsigned c = 0; c < numChan && ok; ++c)
+      ok = rings[c].allocate((blockSize + 2) * sizeof(float));
+    if (ok) {
+      ringFrames = rings[0].size() / sizeof(float);
+      ringPos = 0;
+      for (unsigned c = 0; c < numChan; ++c)
+        plugbuf[c] = (float *) rings[c].base();
+    } else {
+      for (unsigned c = 0; c < numChan; ++c)
+        rings[c].release();
+    }
+  }
+  if (! ringFrames) {
+    for (unsigned c = 0; c < numChan; ++c)
+      // use fftwf_alloc_real to make sure we have alignment suitable for in-place SIMD FFTs
+      plugbuf[c] =  fftwf_alloc_real(blockSize + 2);  // FIXME: is "+2" only to leave room for DFT?;
+  }
+  for (unsigned c = 0; c < numChan; ++c) {
+    if (ringFrames)
+      RTSched::prefault(rings[c].base(), rings[c].size());
+    else
+      RTSched::prefault(plugbuf[c], (blockSize + 2) * sizeof(float));
+  }
 
   // make sure the named output is valid
 
@@ -130,13 +176,18 @@ PluginRunner::PluginRunner(const string &label, const string &devLabel, int rate
   totalFeatures(0),
   plugin(0),
   plugbuf(0),
+  ringFrames(0),
+  ringPos(0),
   outputNo(-1),
   blockSize(0),
   stepSize(0),
   framesInPlugBuf(0),
   isOutputBinary(false),
   resampleScale(1.0 / maxSampleAbs),
-  lastFrametimestamp(0)
+  lastFrametimestamp(0),
+  workerOwned(false),
+  featuresFD(-1),
+  droppedBlocks(0)
 {
 
   // try load the plugin and throw if we fail
@@ -145,6 +196,16 @@ PluginRunner::PluginRunner(const string &label, const string &devLabel, int rate
     delete_privates();
     throw std::runtime_error("Could not load plugin or plugin is not compatible");
   }
+
+  // with worker threads, features come back to the main thread via an eventfd
+
+  if (PluginWorkerPool::enabled()) {
+    featuresFD = eventfd(0, EFD_NONBLOCK);
+    if (featuresFD < 0) {
+      delete_privates();
+      throw std::runtime_error("Could not create eventfd for plugin worker output");
+    }
+  }
 };
 
 PluginRunner::~PluginRunner() {
@@ -170,61 +231,94 @@ void PluginRunner::removeAllOutputListeners() {
   outputListeners.clear();
 };
 
-void PluginRunner::handleData(long avail, int16_t *src0, int16_t *src1, int step, double frameTimestamp) {
-  // alsaHandler has some data for us.  If src1 is NULL, it's only one channel; otherwise it's two channels
+void PluginRunner::handleData(long avail, const int16_t *src, double frameTimestamp) {
+  handleSamples(avail, src, frameTimestamp);
+};
+
+void PluginRunner::handleData(long avail, const int32_t *src, double frameTimestamp) {
+  handleSamples(avail, src, frameTimestamp);
+};
+
+template < typename T >
+void PluginRunner::handleSamples(long avail, const T *src, double frameTimestamp) {
+  // the device has some data for us: avail frames of numChan interleaved channels
 
   // get timestamp of first (hardware) frame in plugin's buffer
   frameTimestamp -= (double) framesInPlugBuf / rate;
 
   while (avail > 0) {
     int hw_frames_to_copy = std::min((int) avail, blockSize - framesInPlugBuf);
-    float *pb0 = plugbuf[0] + framesInPlugBuf;
-    float *pb1 = plugbuf[1] + framesInPlugBuf;
 
-    for (int i = 0; i < hw_frames_to_copy; ++i, ++pb0, src0 += step) {
-      *pb0 = *src0 * resampleScale;
-    }
-    if (src1) {
-      for (int i = 0; i < hw_frames_to_copy; ++i, ++pb1, src1 += step) {
-        *pb1 = *src1 * resampleScale;
-      }
+    for (unsigned c = 0; c < numChan; ++c) {
+      float *pb = plugbuf[c] + framesInPlugBuf;
+      const T *s = src + c;
+      for (int i = 0; i < hw_frames_to_copy; ++i, ++pb, s += numChan)
+        *pb = *s * resampleScale;
     }
+    src += hw_frames_to_copy * numChan;
 
     avail -= hw_frames_to_copy;
     totalFrames += hw_frames_to_copy;
     framesInPlugBuf += hw_frames_to_copy;
 
-    if (framesInPlugBuf == blockSize) {
-      // time to call the plugin
-
-      RealTime rt = RealTime::fromSeconds( frameTimestamp );
-      outputFeatures(plugin->process(plugbuf, rt), label);
-
-      // shift samples if we're not advancing by a full
-      // block.
-      // Too bad the VAMP specs don't let the
-      // process() function deal with two segments for each
-      // buffer; then we wouldn't need these wastefull calls
-      // to memmove!  MAYBE FIXME: fake this by changing our own
-      // plugin to have blockSize = stepSize and deal
-      // internally with handling overlap!  Then fix this
-      // code so copying from alsa's mmap segment is done in
-      // one pass for all plugins waiting on a device, then
-      // the mmap segment is marked as available, then
-      // another pass calls process() on all plugins with
-      // full buffers.
-
-      if (stepSize < blockSize) {
-        memmove(&plugbuf[0][0], &plugbuf[0][stepSize], (blockSize - stepSize) * sizeof(float));
-        if (src1)
-          memmove(&plugbuf[1][0], &plugbuf[1][stepSize], (blockSize - stepSize) * sizeof(float));
-        framesInPlugBuf = blockSize - stepSize;
-        frameTimestamp += (double) stepSize / rate;
-      } else {
-        framesInPlugBuf = 0;
-        frameTimestamp += (double) blockSize / rate;
-      }
+    if (framesInPlugBuf == blockSize)
+      blockFull(frameTimestamp);
+  }
+};
+
+void PluginRunner::handleData(long avail, float * const *src, double frameTimestamp) {
+  // the device has already converted this stream to float for all
+  // plugins with our scale, so we only need to copy it into place
+
+  frameTimestamp -= (double) framesInPlugBuf / rate;
+
+  long done = 0;
+  while (done < avail) {
+    int frames_to_copy = std::min((int) (avail - done), blockSize - framesInPlugBuf);
+    for (unsigned c = 0; c < numChan; ++c)
+      memcpy(plugbuf[c] + framesInPlugBuf, src[c] + done, frames_to_copy * sizeof(float));
+
+    done += frames_to_copy;
+    totalFrames += frames_to_copy;
+    framesInPlugBuf += frames_to_copy;
+
+    if (framesInPlugBuf == blockSize)
+      blockFull(frameTimestamp);
+  }
+};
+
+void PluginRunner::blockFull(double &frameTimestamp) {
+  // time to call the plugin
+
+  if (PluginWorkerPool::enabled()) {
+    queueBlock(frameTimestamp);
+  } else {
+    RealTime rt = RealTime::fromSeconds( frameTimestamp );
+    uint64_t t0 = StatHistogram::nowNS();
+    Plugin::FeatureSet features = plugin->process(plugbuf, rt);
+    processNS.record(StatHistogram::nowNS() - t0);
+    outputFeatures(features, label);
+  }
+
+  // shift samples if we're not advancing by a full
+  // block.  With mirrored rings, that's just moving the window;
+  // otherwise, the VAMP specs don't let the process() function
+  // deal with two segments for each buffer, so we need a memmove.
+
+  if (stepSize < blockSize) {
+    if (ringFrames) {
+      ringPos = (ringPos + stepSize) % ringFrames;
+      for (unsigned c = 0; c < numChan; ++c)
+        plugbuf[c] = (float *) rings[c].base() + ringPos;
+    } else {
+      for (unsigned c = 0; c < numChan; ++c)
+        memmove(&plugbuf[c][0], &plugbuf[c][stepSize], (blockSize - stepSize) * sizeof(float));
     }
+    framesInPlugBuf = blockSize - stepSize;
+    frameTimestamp += (double) stepSize / rate;
+  } else {
+    framesInPlugBuf = 0;
+    frameTimestamp += (double) blockSize / rate;
   }
 };
 
@@ -286,6 +380,13 @@ PluginRunner::outputFeatures(Plugin::FeatureSet features, string prefix)
   }
 };
 
+void PluginRunner::addStatsFields(std::ostream & s) {
+  s << ",\"totalFrames\":" << totalFrames
+    << ",\"totalFeatures\":" << totalFeatures
+    << ",\"droppedBlocks\":" << droppedBlocks
+    << ",\"processNS\":" << processNS.toJSON();
+};
+
 string PluginRunner::toJSON() {
   ostringstream s;
   s << "{"
@@ -296,7 +397,10 @@ string PluginRunner::toJSON() {
     << "\"pluginID\":\"" << pluginID << "\","
     << "\"pluginOutput\":\"" << pluginOutput << "\","
     << "\"totalFrames\":" << totalFrames << ","
-    << "\"totalFeatures\":" << totalFeatures
+    << "\"totalFeatures\":" << totalFeatures << ","
+    << "\"queuedBlocks\":" << queuedBlockCount() << ","
+    << "\"droppedBlocks\":" << droppedBlocks << ","
+    << "\"mirroredInput\":" << (ringFrames ? "true" : "false")
     << "}";
   return s.str();
 }
@@ -322,25 +426,138 @@ PluginRunner::start(double timeNow) {
 
 void
 PluginRunner::setParameters(ParamSet &ps) {
-  if (plugin)
+  if (plugin) {
+    boost::lock_guard < boost::mutex > lock(pluginMutex);
     for (ParamSetIter it = ps.begin(); it != ps.end(); ++it)
       plugin->setParameter(it->first, it->second);
+  }
+};
+
+int
+PluginRunner::queuedBlockCount() {
+  boost::lock_guard < boost::mutex > lock(PluginWorkerPool::mutex);
+  return queuedBlocks.size();
+};
+
+void
+PluginRunner::queueBlock(double frameTimestamp) {
+  // copy the full plugin buffers into a block and hand it to the worker pool.
+  // Called on the main thread.
+
+  boost::lock_guard < boost::mutex > lock(PluginWorkerPool::mutex);
+  if (queuedBlocks.size() >= (unsigned) MAX_QUEUED_BLOCKS) {
+    ++droppedBlocks;
+    return;
+  }
+  PluginBlock *blk;
+  if (freeBlocks.size() > 0) {
+    blk = freeBlocks.back();
+    freeBlocks.pop_back();
+  } else {
+    blk = new PluginBlock;
+    blk->samples.resize(numChan * blockSize);
+  }
+  for (unsigned c = 0; c < numChan; ++c)
+    memcpy(& blk->samples[c * blockSize], plugbuf[c], blockSize * sizeof(float));
+  blk->timestamp = frameTimestamp;
+  queuedBlocks.push_back(blk);
+  if (! workerOwned) {
+    workerOwned = true;
+    PluginWorkerPool::schedule(this);
+  }
+};
+
+void
+PluginRunner::processQueuedBlock() {
+  // called on a worker thread, which owns this PluginRunner until
+  // we set workerOwned to false or reschedule it.
+
+  PluginBlock *blk;
+  {
+    boost::lock_guard < boost::mutex > lock(PluginWorkerPool::mutex);
+    if (queuedBlocks.empty()) {
+      workerOwned = false;
+      PluginWorkerPool::idle.notify_all();
+      return;
+    }
+    blk = queuedBlocks.front();
+    queuedBlocks.pop_front();
+  }
+
+  float * bufs[MAX_NUM_CHAN];
+  for (unsigned c = 0; c < numChan; ++c)
+    bufs[c] = & blk->samples[c * blockSize];
+
+  Plugin::FeatureSet features;
+  {
+    boost::lock_guard < boost::mutex > lock(pluginMutex);
+    uint64_t t0 = StatHistogram::nowNS();
+    features = plugin->process(bufs, RealTime::fromSeconds(blk->timestamp));
+    processNS.record(StatHistogram::nowNS() - t0);
+  }
+
+  // once ownership is given up, cancel() can return and this
+  // PluginRunner (and featuresFD) can be destroyed, so everything that
+  // touches it, including waking the main thread, is done first.
+
+  boost::lock_guard < boost::mutex > lock(PluginWorkerPool::mutex);
+  freeBlocks.push_back(blk);
+  if (features[outputNo].size() > 0) {
+    queuedFeatures.push_back(features);
+    uint64_t one = 1;
+    if (write(featuresFD, & one, sizeof(one)) < 0)
+      std::cerr << "write to features eventfd failed for " << label << std::endl;
+  }
+  if (queuedBlocks.empty()) {
+    workerOwned = false;
+    PluginWorkerPool::idle.notify_all();
+  } else {
+    PluginWorkerPool::schedule(this);
+  }
+};
+
+void
+PluginRunner::recycleQueuedBlocks() {
+  while (! queuedBlocks.empty()) {
+    freeBlocks.push_back(queuedBlocks.front());
+    queuedBlocks.pop_front();
+  }
 };
 
 int
 PluginRunner::getNumPollFDs() {
-  /* do nothing */
-  return 0;
+  // only polled when features come back from worker threads
+  return featuresFD >= 0 ? 1 : 0;
 };
 
 int
 PluginRunner::getPollFDs (struct pollfd * pollfds) {
-  /* do nothing */
+  if (featuresFD >= 0) {
+    pollfds->fd = featuresFD;
+    pollfds->events = POLLIN;
+  }
   return 0;
 };
 
 void
 PluginRunner::handleEvents (struct pollfd *pollfds, bool timedOut, double timeNow)
 {
-  /* do nothing */
+  // output any features returned by worker threads, in the order their blocks were queued
+
+  if (featuresFD < 0 || timedOut || ! (pollfds->revents & POLLIN))
+    return;
+  uint64_t count;
+  if (read(featuresFD, & count, sizeof(count)) < 0)
+    return;
+  for (;;) {
+    Plugin::FeatureSet features;
+    {
+      boost::lock_guard < boost::mutex > lock(PluginWorkerPool::mutex);
+      if (queuedFeatures.empty())
+        break;
+      features.swap(queuedFeatures.front());
+      queuedFeatures.pop_front();
+    }
+    outputFeatures(features, label);
+  }
 };
@@ -13,16 +13,27 @@
 #include <memory>
 #include <fftw3.h>
 #include <cstring>
+#include <deque>
+#include <boost/thread/mutex.hpp>
 
 using namespace Vamp;
 using namespace Vamp::HostExt;
 
 #include "ParamSet.hpp"
 #include "Pollable.hpp"
+#include "MirroredRing.hpp"
 
 typedef std::map < std::string, boost::weak_ptr < Pollable > > OutputListenerSet;
 
+// a full block of plugin input waiting for a worker thread
+typedef struct {
+  std::vector < float > samples;      // blockSize frames for each channel, one channel after another
+  double                timestamp;    // timestamp of first frame in block
+} PluginBlock;
+
 class PluginRunner : public Pollable {
+  friend class PluginWorkerPool;
+
 public:
   string             label;            // name of this plugin runner (used in commands)
   string             devLabel;         // label of device from which plugin receives input
@@ -31,6 +42,7 @@ public:
   string             pluginOutput;     // name of output to obtain from plugin
   ParamSet           pluginParams;     // parameter settings for plugin
   static const int   MAX_NUM_CHAN = 16;// maximum number of channels a plugin can handle
+  static const int   MAX_QUEUED_BLOCKS = 64; // maximum number of blocks waiting for a worker thread before we drop them
 protected:
   static PluginLoader *pluginLoader;   // plugin loader (singleton)
   VampAlsaHost *     host;             // host
@@ -41,6 +53,9 @@ protected:
   long long          totalFeatures;    // total number of "features" (e.g. lotek pulses) seen on this FCD
   Plugin *           plugin;           // VAMP plugin we'll be running on this fcd
   float **           plugbuf;          // pointer to one buffer for each channel (left, right) of float data for plugin
+  MirroredRing       rings[MAX_NUM_CHAN]; // mirrored buffers plugbuf points into, when blocks overlap
+  int                ringFrames;       // frames in each of rings; 0 means plugbuf holds ordinary buffers
+  int                ringPos;          // offset (in frames) of the plugbuf windows into rings
   int                outputNo;         // index of plugin output corresponding to pluginOutput
   int                blockSize;        // size (in frames) of blocks sent to plugin
   int                stepSize;         // amount (in frames) by which consecutive blocks differ
@@ -49,6 +64,19 @@ protected:
   float              resampleScale;    // scale factor for a sum of hardware samples
   double             lastFrametimestamp; // frame timestamp from prvious call to handleData
 
+  // when PluginWorkerPool is enabled, process() is called from a worker
+  // thread.  The block and feature queues and workerOwned are guarded
+  // by PluginWorkerPool::mutex.
+
+  std::deque < PluginBlock * > queuedBlocks;   // full blocks waiting for a worker
+  std::vector < PluginBlock * > freeBlocks;    // blocks available for reuse
+  std::deque < Plugin::FeatureSet > queuedFeatures; // output from process() waiting for the main thread
+  bool               workerOwned;      // true while this plugin is waiting for or being run by a worker
+  int                featuresFD;       // eventfd written by workers when queuedFeatures becomes non-empty
+  long long          droppedBlocks;    // blocks dropped because too many were waiting for a worker
+  boost::mutex       pluginMutex;      // held while calling plugin methods that might be called from a worker
+  StatHistogram      processNS;        // time in plugin->process(), reported by the 'stats' command
+
   // the output buffer gets filled before it can be written to a socket,
   // the oldest output is discarded line by line, so that any output line
   // is either completely written or not written at all.  For binary output,
@@ -65,9 +93,16 @@ public:
   void removeAllOutputListeners();
 
   int loadPlugin();
-  void handleData(long avail, int16_t *src0, int16_t *src1, int step, double frameTimestamp);
+  int getRate() {return rate;};
+  void handleData(long avail, const int16_t *src, double frameTimestamp); // interleaved frames, to be scaled here
+  void handleData(long avail, const int32_t *src, double frameTimestamp); // the same, for S32 frames
+  void handleData(long avail, float * const *src, double frameTimestamp); // already-scaled, deinterleaved frames
+  float getScale() {return resampleScale;};
+  int queuedBlockCount();               // number of blocks waiting for a worker thread
+  unsigned getNumChan() {return numChan;};
   void outputFeatures(Plugin::FeatureSet features, string prefix);
   string toJSON();
+  void addStatsFields(std::ostream & s);
 
   int getNumPollFDs();
                       // return number of fds used by this Pollable (negative means error)
@@ -83,6 +118,14 @@ public:
 
   void setParameters(ParamSet &ps);
 
+protected:
+  void blockFull(double &frameTimestamp); // run or queue a full plugbuf, then shift it by stepSize
+  template < typename T >
+  void handleSamples(long avail, const T *src, double frameTimestamp); // either handleData for interleaved frames
+  void queueBlock(double frameTimestamp); // copy plugbuf to a block and queue it for a worker thread
+  void processQueuedBlock();              // run process() on the oldest queued block; called on a worker thread
+  void recycleQueuedBlocks();             // discard queued blocks; caller must hold PluginWorkerPool::mutex
+
 private:
   void delete_privates();
 };
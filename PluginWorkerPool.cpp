@@ -0,0 +1,63 @@
+#include "PluginWorkerPool.hpp"
+#include "PluginRunner.hpp"
+#include "RTSched.hpp"
+#include <algorithm>
+#include <sstream>
+
+void
+PluginWorkerPool::start(int n) {
+  if (numThreads > 0 || n <= 0)
+    return;
+  numThreads = std::min(n, MAX_THREADS);
+  for (int i = 0; i < numThreads; ++i) {
+    boost::thread * t = workers.create_thread(workerLoop);
+    std::ostringstream name;
+    name << "worker:" << i;
+    RTSched::addThread(name.str(), t->native_handle(), true);
+  }
+};
+
+void
+PluginWorkerPool::schedule(PluginRunner *pr) {
+  ready.push_back(pr);
+  wakeup.notify_one();
+};
+
+void
+PluginWorkerPool::cancel(PluginRunner *pr, boost::unique_lock < boost::mutex > & lock) {
+  // discard any blocks not yet processed.  If pr is waiting for a worker,
+  // just drop it from the ready queue; otherwise a worker might be in
+  // pr's process(), so wait for it to finish.
+
+  pr->recycleQueuedBlocks();
+  std::deque < PluginRunner * >::iterator i = std::find(ready.begin(), ready.end(), pr);
+  if (i != ready.end()) {
+    ready.erase(i);
+    pr->workerOwned = false;
+  }
+  while (pr->workerOwned)
+    idle.wait(lock);
+};
+
+void
+PluginWorkerPool::workerLoop() {
+  for (;;) {
+    PluginRunner *pr;
+    {
+      boost::unique_lock < boost::mutex > lock(mutex);
+      while (ready.empty())
+        wakeup.wait(lock);
+      pr = ready.front();
+      ready.pop_front();
+    }
+    pr->processQueuedBlock();
+  }
+};
+
+// static initializers
+int PluginWorkerPool::numThreads = 0;
+boost::mutex PluginWorkerPool::mutex;
+boost::condition_variable PluginWorkerPool::idle;
+boost::condition_variable PluginWorkerPool::wakeup;
+std::deque < PluginRunner * > PluginWorkerPool::ready;
+boost::thread_group PluginWorkerPool::workers;
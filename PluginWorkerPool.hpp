@@ -0,0 +1,43 @@
+#ifndef PLUGINWORKERPOOL_HPP
+#define PLUGINWORKERPOOL_HPP
+
+/*
+  A pool of worker threads which run Plugin::process() for PluginRunners.
+
+  Each PluginRunner queues full blocks of input on itself, then asks the
+  pool to schedule it.  A PluginRunner is owned by at most one worker at
+  a time, and its blocks are processed in the order queued, so a plugin
+  sees the same sequence of process() calls it would if run inline.
+  Features are handed back to the main thread by the PluginRunner itself.
+*/
+
+#include <deque>
+#include <boost/thread.hpp>
+
+class PluginRunner;
+
+class PluginWorkerPool {
+
+public:
+  static const int MAX_THREADS = 32;  // maximum number of worker threads
+
+  static void start(int numThreads);  // start numThreads workers; 0 means run plugins inline on the main thread
+  static bool enabled() { return numThreads > 0; };
+  static int getNumThreads() { return numThreads; };
+
+  static void schedule(PluginRunner *pr); // queue pr to be run by a worker; caller must hold mutex
+  static void cancel(PluginRunner *pr, boost::unique_lock < boost::mutex > & lock); // drop pr's queued blocks and wait until no worker owns it
+
+  static boost::mutex mutex;          // guards the ready queue and the block queues of all PluginRunners
+  static boost::condition_variable idle; // notified whenever a worker releases a PluginRunner
+
+protected:
+  static int numThreads;
+  static std::deque < PluginRunner * > ready; // PluginRunners with queued blocks, waiting for a worker
+  static boost::condition_variable wakeup; // notified when ready becomes non-empty
+  static boost::thread_group workers;
+
+  static void workerLoop();
+};
+
+#endif // PLUGINWORKERPOOL_HPP
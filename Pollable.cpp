@@ -1,10 +1,14 @@
 #include "Pollable.hpp"
+#include "RTSched.hpp"
 #include <stdint.h>
+#include <sstream>
 
 Pollable::Pollable(const std::string label) :
   label(label),
   indexInPollFD(-1),
-  outputBuffer(DEFAULT_OUTPUT_BUFFER_SIZE)
+  outputBuffer(DEFAULT_OUTPUT_BUFFER_SIZE),
+  blockBytes(0),
+  blockCursor(0)
 {
   pollfd.fd = -1;
   pollables[label] = boost::shared_ptr < Pollable > (this);
@@ -71,7 +75,10 @@ Pollable::poll(int timeout) {
   doing_poll = true;
 
   regenFDs();
+  uint64_t t0 = StatHistogram::nowNS();
   int rv = ::poll(& allpollfds[0], allpollfds.size(), timeout);
+  uint64_t t1 = StatHistogram::nowNS();
+  pollWaitNS.record(t1 - t0);
   if (rv < 0) {
     doing_poll = false;
     //    std::cerr << "poll returned error - vamp-alsa-host" << std::endl;
@@ -89,6 +96,9 @@ Pollable::poll(int timeout) {
     int i = ptr->indexInPollFD;
     if (i < 0)
       continue;
+    // NB: only the first fd of each Pollable is checked for events
+    if (allpollfds[i].revents)
+      loopLagNS.record(StatHistogram::nowNS() - t1);
     ptr->handleEvents(&allpollfds[i], timedOut, VampAlsaHost::now());
     if (regen_pollfds)
       break;
@@ -139,42 +149,96 @@ Pollable::regenFDs() {
 
 bool
 Pollable::queueOutput(const char *p, uint32_t len, double timestamp) {
-  if ((unsigned) len > outputBuffer.capacity())
+  if ((unsigned) len > outputBuffer.capacity()) {
+    droppedBytes.add(len);
     return false;
+  }
 
-  outputBuffer.insert(outputBuffer.end(), p, p + len);
-  pollfd.events |= POLLOUT;
-  if (indexInPollFD >= 0)
-    eventsOf(0) = pollfd.events;
+  queuedBytes.add(len);
+  if (blocks.empty()) {
+    // circular_buffer overwrites the oldest bytes when full
+    if (outputBuffer.size() + len > outputBuffer.capacity())
+      droppedBytes.add(outputBuffer.size() + len - outputBuffer.capacity());
+    outputBuffer.insert(outputBuffer.end(), p, p + len);
+  } else {
+    // keep output in order by copying into a block behind those already queued
+    makeRoom(len);
+    blocks.push_back(OutputBlock::alloc(p, len));
+    blockBytes += len;
+  }
+  outputQueued();
+  return true;
+};
 
+bool
+Pollable::queueOutput(const OutputBlock::Ptr &blk, double timestamp) {
+  uint32_t len = blk->size();
+  if ((unsigned) len > outputBuffer.capacity()) {
+    droppedBytes.add(len);
+    return false;
+  }
+
+  queuedBytes.add(len);
+  makeRoom(len);
+  blocks.push_back(blk);
+  blockBytes += len;
+  outputQueued();
   return true;
+};
+
+void
+Pollable::makeRoom(uint32_t len) {
+  // as with outputBuffer on its own, the oldest output is dropped when
+  // there's no room for new output
+  uint32_t cap = outputBuffer.capacity();
+  while (outputSize() + len > cap) {
+    if (! outputBuffer.empty()) {
+      uint32_t n = std::min((uint32_t) outputBuffer.size(), outputSize() + len - cap);
+      outputBuffer.erase_begin(n);
+      droppedBytes.add(n);
+    } else {
+      droppedBytes.add(blocks.front()->size() - blockCursor);
+      blockBytes -= blocks.front()->size() - blockCursor;
+      blockCursor = 0;
+      blocks.pop_front();
+    }
+  }
+};
+
+void
+Pollable::prefaultOutput() {
+  if (! RTSched::wantPrefault() || ! outputBuffer.empty())
+    return;
+  // filling the buffer writes every page of its storage
+  outputBuffer.resize(outputBuffer.capacity());
+  outputBuffer.clear();
+};
 
+void
+Pollable::outputQueued() {
+  pollfd.events |= POLLOUT;
+  if (indexInPollFD >= 0)
+    eventsOf(0) = pollfd.events;
 };
 
 int
 Pollable::writeSomeOutput (int maxBytes) {
   // assuming the output FD is ready for non-blocking output, (i.e. POLLOUT true)
-  // write up to maxBytes to it from the output buffer.  Return the number of
-  // bytes written.  Negative return values indicate an error.
+  // write up to maxBytes to it from the output buffer, or if that's empty,
+  // from the first queued block.  Return the number of bytes written.
+  // Negative return values indicate an error.
 
-  int len = outputBuffer.size();
-  if (len > 0) {
-    int toWrite = std::min(maxBytes, len);
+  const char * src;
+  int len;
+  if (! outputBuffer.empty()) {
     // write only from the first array; a subsequent call to this handler can write data
     // which is now in the second array but which will eventually be in the first array.
     boost::circular_buffer < char > ::array_range aone = outputBuffer.array_one();
-    toWrite = std::min(toWrite, (int)aone.second);
-    int num_bytes = write(pollfd.fd, (char *) aone.first, toWrite);
-    if (num_bytes < 0) {
-      // error writing, call the error callback
-      pollfd.events &= ~POLLOUT;
-      if (indexInPollFD >= 0)
-        eventsOf(0) = pollfd.events;
-      return num_bytes;
-    } else if (num_bytes > 0) {
-      outputBuffer.erase_begin(num_bytes);
-    }
-    return num_bytes;
+    src = aone.first;
+    len = aone.second;
+  } else if (! blocks.empty()) {
+    src = blocks.front()->data() + blockCursor;
+    len = blocks.front()->size() - blockCursor;
   } else {
     // output buffer is empty; stop writing
     pollfd.events &= ~POLLOUT;
@@ -182,6 +246,29 @@ Pollable::writeSomeOutput (int maxBytes) {
       eventsOf(0) = pollfd.events;
     return 0;
   }
+
+  int toWrite = std::min(maxBytes, len);
+  int num_bytes = write(pollfd.fd, src, toWrite);
+  if (num_bytes < 0) {
+    // error writing, call the error callback
+    pollfd.events &= ~POLLOUT;
+    if (indexInPollFD >= 0)
+      eventsOf(0) = pollfd.events;
+    return num_bytes;
+  } else if (num_bytes > 0) {
+    if (! outputBuffer.empty()) {
+      outputBuffer.erase_begin(num_bytes);
+    } else {
+      blockCursor += num_bytes;
+      blockBytes -= num_bytes;
+      if (blockCursor == blocks.front()->size()) {
+        // done with this block; it returns to the pool once every listener is done with it
+        blocks.pop_front();
+        blockCursor = 0;
+      }
+    }
+  }
+  return num_bytes;
 };
 
 void
@@ -194,6 +281,30 @@ Pollable::asyncMsg(std::string msg) {
   }
 }
 
+string
+Pollable::statsJSON() {
+  std::ostringstream s;
+  s << "{"
+    << "\"queuedBytes\":" << queuedBytes.get() << ","
+    << "\"droppedBytes\":" << droppedBytes.get() << ","
+    << "\"waitingBytes\":" << outputSize();
+  addStatsFields(s);
+  s << "}";
+  return s.str();
+};
+
+string
+Pollable::loopStatsJSON() {
+  std::ostringstream s;
+  s << "{"
+    << "\"pollWaitNS\":" << pollWaitNS.toJSON() << ","
+    << "\"loopLagNS\":" << loopLagNS.toJSON() << ","
+    << "\"outputBlocksAllocated\":" << OutputBlock::numAllocated() << ","
+    << "\"outputBlocksPooled\":" << OutputBlock::numPooled()
+    << "}";
+  return s.str();
+};
+
 void
 Pollable::setControlSocket(std::string label) {
   controlSocketLabel = label;
@@ -219,3 +330,5 @@ bool Pollable::have_deferrals = false;
 bool Pollable::doing_poll = false;
 bool Pollable::terminating = false;
 string Pollable::controlSocketLabel = "";
+StatHistogram Pollable::loopLagNS;
+StatHistogram Pollable::pollWaitNS;
@@ -10,6 +10,7 @@
 #include <string>
 #include <stdexcept>
 #include <stdint.h>
+#include <deque>
 #include <boost/circular_buffer.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
@@ -21,6 +22,8 @@
 //using boost::static_pointer_cast;
 
 #include "VampAlsaHost.hpp"
+#include "OutputBlock.hpp"
+#include "Stats.hpp"
 
 class Pollable;
 typedef std::map < std::string, boost::shared_ptr<Pollable> > PollableSet;
@@ -41,6 +44,7 @@ public:
   static void setControlSocket(string label);
   static void controlSocketClosed();
   static bool haveControlSocket();
+  static std::string loopStatsJSON(); // event loop metrics
 
 protected:
   static std::vector <struct pollfd> allpollfds; // in same order as pollables, but some pollables may have 0 or more than 1 FD
@@ -52,6 +56,8 @@ protected:
   static void regenFDs();
   static void asyncMsg(std::string msg); // send an asynchronous message to the control TCP connection (the first tcp connection)
   static string controlSocketLabel;
+  static StatHistogram loopLagNS;  // time from poll() returning to dispatching events to a Pollable with events
+  static StatHistogram pollWaitNS; // time spent blocked in poll()
 
   /* instance members */
 
@@ -63,9 +69,13 @@ public:
 
   string label;
   virtual string toJSON() = 0;
+  string statsJSON();          // hot-path metrics, as a JSON object
   virtual bool queueOutput(const char * p, uint32_t len, double timestamp = 0.0);
   virtual bool queueOutput(std::string &str, double timestamp = 0) {return queueOutput(str.data(), str.length(), timestamp);};
+  virtual bool queueOutput(const OutputBlock::Ptr &blk, double timestamp = 0.0); // queue a reference to blk rather than a copy of its bytes
   int writeSomeOutput(int maxBytes);
+  uint32_t outputSize() {return outputBuffer.size() + blockBytes;}; // bytes waiting to be written
+  uint32_t outputReserve() {return outputBuffer.capacity() - std::min((uint32_t) outputBuffer.capacity(), outputSize());}; // bytes which can be queued without dropping any
 
   short & eventsOf(int offset = 0); // reference to the events field for a pollfd
 
@@ -83,6 +93,19 @@ protected:
 
   boost::circular_buffer < char > outputBuffer;
   bool outputPaused;
+  StatCounter queuedBytes;   // bytes accepted by queueOutput
+  StatCounter droppedBytes;  // bytes dropped for lack of room, old or new
+
+  // Output queued by reference; all of it follows whatever is in
+  // outputBuffer, and outputBuffer's capacity bounds the total.
+  std::deque < OutputBlock::Ptr > blocks;
+  uint32_t blockBytes;   // unwritten bytes in blocks
+  uint32_t blockCursor;  // bytes of blocks.front() already written
+
+  virtual void addStatsFields(std::ostream & s) {}; // append subclass metrics to statsJSON(), each preceded by ','
+  void makeRoom(uint32_t len); // drop oldest output so len more bytes fit
+  void prefaultOutput();       // touch all of outputBuffer's storage, if memory locking was requested; call while it is empty
+  void outputQueued();   // enable POLLOUT after queueing
 };
 
 #endif /* POLLABLE_HPP */
@@ -1,8 +1,9 @@
 #include "RTLSDRMinder.hpp"
-#include <sys/ioctl.h>
+#include "U8Expand.hpp"
 #include <stdint.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <iostream>
 
 #define UNIX_PATH_MAX 108
 
@@ -14,11 +15,28 @@ void RTLSDRMinder::delete_privates() {
 };
 
 int RTLSDRMinder::hw_open() {
+  if (reqFormat.length() > 0 && reqFormat != hw_formatName()) {
+    std::cerr << "rtlsdr devices only deliver " << hw_formatName() << " samples\n";
+    return 5;
+  }
+  if (reqPeriodFrames > 0 || reqWakeups > 0) {
+    // data arrives whenever rtl_tcp sends it, so there's no period to set
+    std::cerr << "rtlsdr devices don't accept a period or wakeup rate\n";
+    return 4;
+  }
   rtltcp = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
   if (rtltcp < 0) {
     std::cerr << "unable to open socket fd for rtlsdr\n";
     return 1;
   }
+  if (reqBufferFrames > 0) {
+    // the socket's receive buffer is all that holds frames until we read them
+    int bytes = reqBufferFrames * 2; // hardcoded: 1 byte per sample, two channels (I/Q)
+    if (setsockopt(rtltcp, SOL_SOCKET, SO_RCVBUF, & bytes, sizeof(bytes))) {
+      std::cerr << "unable to set receive buffer size for rtlsdr\n";
+      return 3;
+    }
+  }
   memset(& rtltcpAddr, 0, sizeof(struct sockaddr_un));
   rtltcpAddr.sun_family = AF_UNIX;
   snprintf(rtltcpAddr.sun_path, UNIX_PATH_MAX, socketPath.c_str());
@@ -29,6 +47,15 @@ int RTLSDRMinder::hw_open() {
   return getHWRateForRate(rate);
 };
 
+int RTLSDRMinder::hw_bufferFrames() {
+  // NB: linux reports twice the size requested, the extra being for its own bookkeeping
+  int bytes = 0;
+  socklen_t len = sizeof(bytes);
+  if (rtltcp < 0 || getsockopt(rtltcp, SOL_SOCKET, SO_RCVBUF, & bytes, & len))
+    return 0;
+  return bytes / 2; // hardcoded: 1 byte per sample, two channels (I/Q)
+};
+
 bool RTLSDRMinder::hw_is_open() {
   return rtltcp >= 0;
 };
@@ -37,6 +64,10 @@ int RTLSDRMinder::hw_do_stop() {
   return 0;
 };
 
+void RTLSDRMinder::hw_close() {
+  delete_privates();
+};
+
 bool RTLSDRMinder::hw_running(double timeNow) {
   return rtltcp > 0 && timeNow - lastDataReceived < 2.0;
 };
@@ -45,6 +76,7 @@ int RTLSDRMinder::hw_do_start() {
   if (rtltcp < 0 && open())
     return 1;
   hasError = 0;
+  clock.reset(hwRate);
   return 0;
 }
 
@@ -59,7 +91,11 @@ RTLSDRMinder::RTLSDRMinder(const string &devName, int rate, unsigned int numChan
   rtltcp(-1),
   headerValid(false),
   segi(0),
-  bytesAvail(0)
+  staging(STAGING_BYTES),
+  stagePos(0),
+  stageEnd(0),
+  pendingSample(0),
+  havePendingSample(false)
 {
   if (devName.substr(0, 7) != "rtlsdr:")
     throw std::runtime_error("Invalid name for RTLSDR device; must look like 'rtlsdr:PATH'");
@@ -67,6 +103,7 @@ RTLSDRMinder::RTLSDRMinder(const string &devName, int rate, unsigned int numChan
 };
 
 RTLSDRMinder::~RTLSDRMinder() {
+  stopCaptureThread(); // must not be reading hardware while it is closed
   delete_privates();
 };
 
@@ -86,93 +123,108 @@ int RTLSDRMinder::hw_getPollFDs (struct pollfd *pollfds) {
 int RTLSDRMinder::hw_handleEvents ( struct pollfd *pollfds, bool timedOut) {
   if (rtltcp < 0 || timedOut)
     return 0;
-  if (pollfds->revents & POLLIN) {
-    // return number of frames available
-    int avail;
-    ioctl(rtltcp, FIONREAD, &avail);
-    bytesAvail = avail;
-    return (avail + 1) / 2; // hardcoded: 1 byte per sample, two channels (I/Q)
-  }
+  if (pollfds->revents & POLLIN)
+    return hw_availNow();
   return 0;
 };
 
+int RTLSDRMinder::hw_availNow () {
+  // Read everything the socket has into staging with a single recv(),
+  // after any bytes left over from last time; return an upper bound on
+  // the number of frames that yields.
+
+  if (rtltcp < 0)
+    return 0;
+  if (stagePos > 0) {
+    memmove(& staging[0], & staging[stagePos], stageEnd - stagePos);
+    stageEnd -= stagePos;
+    stagePos = 0;
+  }
+  int bytes = recv(rtltcp, & staging[stageEnd], staging.size() - stageEnd, MSG_DONTWAIT);
+  recvCalls.add();
+  if (bytes <= 0)
+    return 0;
+  recvBytes.record(bytes);
+  stageEnd += bytes;
+
+  // if that filled staging, there's probably more waiting, so make room
+  // for it next time
+  if (stageEnd == staging.size() && staging.size() < MAX_STAGING_BYTES)
+    staging.resize(2 * staging.size());
+
+  return (stageEnd - stagePos) / 2 + 1; // hardcoded: 1 byte per sample, two channels (I/Q); +1 for any pendingSample
+};
+
 int RTLSDRMinder::hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp) {
   /*
-    data available in the recv buf look like so:
+    data staged by hw_availNow look like so:
 
      [ seg header, or tail thereof ]? [sample data] [ seg header ] [sample data] ... [seg header] [sample data]
 
     and there is no alignment to stream segment boundaries as we're using a stream-oriented socket protocol
 
-    So we perform one or more recv()'s to completely use up the available byte count (recorded in the
-    most recent call to hw_handleEvents), removing any stream_segment_hdr_t structures; the latest such
-    struct is saved for use of its timestamp and byte count.  We return the count of frames copied to
-    buf, which will not exceed numFrames.
+    So we walk the staged bytes, removing any stream_segment_hdr_t structures; the latest such
+    struct is saved for use of its timestamp and byte count.  Only whole frames are returned; an
+    unpaired final sample is held in pendingSample for the next call.  We return the count of
+    frames copied to buf, which will not exceed numFrames.
 
   */
-  int sampleBytesCopied = 0;
-
-  // we accumulate the best estimate of the timestamp for the first sample in this segment,
-  // getting a separate estimate for each segment header in the current buffer.
-
-  int numTSest = 0;
-  if (segi >= sizeof(stream_segment_hdr_t)) {
-    // we already have a header for the current segment, so
-    // estimate the timestamp of the first sample to be copied to the buffer
-    frameTimestamp = header.ts + ((segi - sizeof(stream_segment_hdr_t)) / 2.0) / hwRate;
-    numTSest = 1;
-  } else {
-    frameTimestamp = 0;
+  int samples = 0;
+  int maxSamples = 2 * numFrames;
+  if (havePendingSample) {
+    buf[samples++] = pendingSample;
+    havePendingSample = false;
   }
 
-  while (bytesAvail > 0) {
+  // segment header timestamps are noisy, so every so often one is fed
+  // to the estimator, and the timestamp of the first frame copied comes
+  // from that.
+
+  while (stagePos < stageEnd && samples < maxSamples) {
+    int bytesAvail = stageEnd - stagePos;
+
     // try finish filling in the current stream_segment_hdr_t, if not already full.
 
-    int hdrBytes  = std::min((int) sizeof(stream_segment_hdr_t) - (int) segi, (int) bytesAvail);
+    int hdrBytes  = std::min((int) sizeof(stream_segment_hdr_t) - (int) segi, bytesAvail);
     if (hdrBytes > 0) {
-      // need to try finish filling in header
-      int bytes = recv(rtltcp, ((char *) (& header)) + segi, hdrBytes, 0);
-      if (bytes != hdrBytes)
-        std::cerr << "Bytes = " << bytes << " but hdrBytes = " << hdrBytes << std::endl;
-      bytesAvail -= bytes;
-      segi +=  bytes;
-      // if new header has been obtained, add a new estimate of the timestamp for the first sample in the buffer
+      memcpy(((char *) (& header)) + segi, & staging[stagePos], hdrBytes);
+      stagePos += hdrBytes;
+      segi +=  hdrBytes;
+      // if a new header has been obtained, its timestamp is for the frame after those copied so far
       if (segi == sizeof(stream_segment_hdr_t)) {
-        frameTimestamp += header.ts - (sampleBytesCopied / 2.0) / hwRate;
-        ++numTSest;
+        long long segIndex = frameIndex + samples / 2;
+        if (clock.wantObservation(segIndex))
+          clock.addObservation(segIndex, header.ts);
       }
       continue;
     }
 
     // try finish the sample data from the stream segment
 
-    int dataBytes = std::min((int) header.size - (int) segi, (int) bytesAvail);
+    int dataBytes = std::min(std::min((int) header.size - (int) segi, bytesAvail), maxSamples - samples);
     if (dataBytes > 0) {
-      // need to continue copying data
-      int bytes = recv(rtltcp, buf, dataBytes, 0);
-      if (bytes != dataBytes)
-        std::cerr << "Bytes = " << bytes << " but dataBytes = " << dataBytes << std::endl;
-
-      // expand the samples from 8 to 16 bits
-      // working from right to left; also, shift left 8 bits so sample downsampling using average method maintains more precision.
-      int16_t * ebuf = buf + (bytes - 1);
-      unsigned char * cbuf = ((unsigned char *) buf) + (bytes - 1);
-      for ( int i = bytes; i > 0; --i, --cbuf, --ebuf)
-        *ebuf = ((int16_t) (int8_t) (*cbuf - 128)) * SAMPLE_SCALE; // scale from 8 to 16 bits, improving precision of averaging downsampling
-
-      bytesAvail -= bytes;
-      segi +=  bytes;
-      sampleBytesCopied += bytes;
-      buf += bytes;
-      if (segi == header.size) {
-        segi = 0;
-      }
-      continue;
+      // scale up so sample downsampling using average method maintains more precision.
+      U8Expand::expand(& staging[stagePos], buf + samples, dataBytes, SAMPLE_SCALE);
+      stagePos += dataBytes;
+      segi +=  dataBytes;
+      samples += dataBytes;
     }
+    if (segi >= header.size)
+      segi = 0;
   }
-  if (numTSest > 1)
-    frameTimestamp /= numTSest;
-  return sampleBytesCopied / 2; // returning # of frames
+  if (samples % 2) {
+    pendingSample = buf[--samples];
+    havePendingSample = true;
+  }
+  frameTimestamp = clock.ready() ? clock.timestampOf(frameIndex) : 0;
+  frameIndex += samples / 2;
+  return samples / 2; // returning # of frames
+};
+
+void RTLSDRMinder::addStatsFields(std::ostream & s) {
+  DevMinder::addStatsFields(s);
+  s << ",\"recvCalls\":" << recvCalls.get()
+    << ",\"recvBytes\":" << recvBytes.toJSON();
 };
 
 int
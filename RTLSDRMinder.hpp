@@ -36,11 +36,19 @@ protected:
   stream_segment_hdr_t   header;      // most recently encountered header in stream
   bool                   headerValid; // is content of latestHeader valid?
   unsigned int           segi;        // how many bytes from this segment (header + data) have been processed, including those from the header
-  unsigned int           bytesAvail;  // bytes available in recv buffer, from latest ioctl()
+  std::vector < unsigned char > staging; // bytes received from rtl_tcp, not yet parsed
+  unsigned int           stagePos;    // offset in staging of first unparsed byte
+  unsigned int           stageEnd;    // offset in staging just past the last received byte
+  int16_t                pendingSample; // I sample of a frame whose Q sample hasn't been parsed yet
+  bool                   havePendingSample;
+  StatCounter            recvCalls;   // recv() calls on the socket, to which reading is meant to be limited
+  StatHistogram          recvBytes;   // bytes returned by each recv() which got any
 
 public:
 
   const static int RTLSDR_FRAMES = 2048;
+  const static int STAGING_BYTES = 65536;     // initial size of staging; doubled whenever a recv() fills it
+  const static int MAX_STAGING_BYTES = 4194304; // ... up to this
   const static int SAMPLE_SCALE = 16;  // amount by which to multiply signed 8-bit samples to get signed 16-bit sample; for plugins, this
                                        // only matters if downsampling by averaging (and then, only improves precision a bit);
                                        // simple subsampling isn't affected, as the scale
@@ -61,16 +69,27 @@ public:
 
   virtual int hw_handleEvents ( struct pollfd *pollfds, bool timedOut);
 
+  virtual bool hw_sweepable () {return true;};
+
+  virtual int hw_availNow ();
+
   virtual int hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp);
 
+  virtual int hw_bufferFrames ();
+
+  virtual const char * hw_formatName () {return "U8";};
+
 protected:
 
   virtual void delete_privates();
   virtual int hw_do_start();
   virtual int hw_do_stop();
+  virtual void hw_close();
   virtual int hw_do_restart();
   virtual bool hw_running(double timeNow);
 
+  void addStatsFields(std::ostream & s);
+
   int getHWRateForRate(int rate); // get minimum sampling rate that is an integer multiple of desired rate; this is the hardware
   // sampling rate that nodejs would have set for this rtlsdr device
   // sets fields hwRate and downsamplefactor correspondingly; returns 0 on sucess, non-zero on error.
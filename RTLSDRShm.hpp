@@ -0,0 +1,54 @@
+#ifndef RTLSDRSHM_HPP
+#define RTLSDRSHM_HPP
+
+/*
+  Layout of the shared-memory ring through which an rtl-sdr producer
+  (e.g. rtl_tcp, or rtlsdr-shm-feed for testing) hands I/Q samples to
+  RTLSDRShmMinder, without a socket's two kernel copies or in-band
+  stream_segment_hdr_t structures.
+
+  The producer creates the ring in a memfd (or an unlinked /dev/shm
+  file) and listens on a unix stream socket.  To each client that
+  connects, it sends one byte carrying two fds as SCM_RIGHTS: the ring,
+  then an eventfd it writes to after each chunk it publishes.
+
+  The ring is a header, a data ring of unsigned 8-bit I/Q samples, and
+  a metadata ring of chunk timestamps, each region starting on a page
+  boundary.  The producer never waits for its consumers: a consumer
+  that falls more than dataBytes behind has lost data, and can tell how
+  much from writeBytes.
+
+  To publish a chunk of whole frames, the producer:
+   - copies its bytes into the data ring at writeBytes % dataBytes, wrapping as needed
+   - stores {writeBytes, timestamp of its first frame} in meta[writeMeta % numMeta]
+   - increments writeMeta, then adds the chunk's size to writeBytes, each
+     with a release store
+   - writes 1 to each client's eventfd
+
+  This is plain C, so a producer needn't be built with this package.
+*/
+
+#include <stdint.h>
+
+#define RTLSDR_SHM_MAGIC   0x53444c52  /* "RLDS" little-endian */
+#define RTLSDR_SHM_VERSION 1
+
+typedef struct {
+  uint32_t magic;       /* RTLSDR_SHM_MAGIC */
+  uint32_t version;     /* RTLSDR_SHM_VERSION */
+  uint32_t rate;        /* I/Q frames per second */
+  uint32_t dataBytes;   /* size of data ring; a power of two, at least a page */
+  uint32_t dataOffset;  /* offset of data ring from start of ring */
+  uint32_t numMeta;     /* slots in metadata ring; a power of two */
+  uint32_t metaOffset;  /* offset of metadata ring from start of ring */
+  uint32_t reserved;
+  uint64_t writeBytes;  /* bytes ever written to data ring */
+  uint64_t writeMeta;   /* entries ever written to metadata ring */
+} rtlsdr_shm_hdr_t;
+
+typedef struct {
+  uint64_t byteIndex;   /* value of writeBytes when the chunk was written, i.e. index of its first byte */
+  double   ts;          /* CLOCK_REALTIME timestamp of its first frame */
+} rtlsdr_shm_meta_t;
+
+#endif /* RTLSDRSHM_HPP */
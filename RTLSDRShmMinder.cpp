@@ -0,0 +1,307 @@
+#include "RTLSDRShmMinder.hpp"
+#include "RTLSDRMinder.hpp"
+#include "U8Expand.hpp"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <iostream>
+
+#define UNIX_PATH_MAX 108
+
+void RTLSDRShmMinder::delete_privates() {
+  if (hdr) {
+    munmap(hdr, mapBytes);
+    hdr = 0;
+    data = 0;
+    meta = 0;
+  }
+  if (ctlFD >= 0) {
+    close(ctlFD);
+    ctlFD = -1;
+  }
+  if (ringFD >= 0) {
+    close(ringFD);
+    ringFD = -1;
+  }
+  if (eventFD >= 0) {
+    close(eventFD);
+    eventFD = -1;
+  }
+};
+
+int RTLSDRShmMinder::hw_open() {
+  if (reqFormat.length() > 0 && reqFormat != hw_formatName()) {
+    std::cerr << "rtlsdr-shm devices only deliver " << hw_formatName() << " samples\n";
+    return 5;
+  }
+  if (reqPeriodFrames > 0 || reqWakeups > 0 || reqBufferFrames > 0) {
+    // data arrives whenever the producer writes it, into a ring the producer sized
+    std::cerr << "rtlsdr-shm devices don't accept a period, wakeup rate, or buffer size\n";
+    return 4;
+  }
+  ctlFD = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (ctlFD < 0) {
+    std::cerr << "unable to open socket fd for rtlsdr-shm\n";
+    return 1;
+  }
+  struct timeval tv = {2, 0}; // don't hang the main loop on a stuck producer
+  setsockopt(ctlFD, SOL_SOCKET, SO_RCVTIMEO, & tv, sizeof(tv));
+
+  struct sockaddr_un addr;
+  memset(& addr, 0, sizeof(struct sockaddr_un));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, UNIX_PATH_MAX, "%s", socketPath.c_str());
+  if (connect(ctlFD, (struct sockaddr *) &addr, sizeof(struct sockaddr_un))) {
+    std::cerr << "unable to connect to socket for rtlsdr-shm\n";
+    delete_privates();
+    return 2;
+  }
+  if (receiveFDs() || mapRing()) {
+    delete_privates();
+    return 3;
+  }
+  hwRate = hdr->rate;
+  if (rate <= 0 || hwRate == 0 || hwRate % rate != 0) { // we only do exact rate decimation
+    std::cerr << "rtlsdr-shm producer's rate " << hwRate << " is not a multiple of " << rate << "\n";
+    delete_privates();
+    return 6;
+  }
+  return 0;
+};
+
+int RTLSDRShmMinder::receiveFDs() {
+  char byte;
+  struct iovec iov = {& byte, 1};
+  union {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  struct msghdr msg;
+  memset(& msg, 0, sizeof(msg));
+  msg.msg_iov = & iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl.buf;
+  msg.msg_controllen = sizeof(ctl.buf);
+
+  if (recvmsg(ctlFD, & msg, MSG_CMSG_CLOEXEC) != 1) {
+    std::cerr << "no fds received from rtlsdr-shm producer\n";
+    return 1;
+  }
+  struct cmsghdr * c = CMSG_FIRSTHDR(& msg);
+  if (! c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+    std::cerr << "no fds received from rtlsdr-shm producer\n";
+    return 1;
+  }
+  int n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+  int fds[2] = {-1, -1};
+  memcpy(fds, CMSG_DATA(c), std::min(n, 2) * sizeof(int));
+  if (n != 2 || (msg.msg_flags & MSG_CTRUNC)) {
+    std::cerr << "rtlsdr-shm producer sent " << n << " fds, not 2\n";
+    for (int i = 0; i < std::min(n, 2); ++i)
+      close(fds[i]);
+    return 1;
+  }
+  ringFD = fds[0];
+  eventFD = fds[1];
+  fcntl(eventFD, F_SETFL, fcntl(eventFD, F_GETFL) | O_NONBLOCK);
+  return 0;
+};
+
+int RTLSDRShmMinder::mapRing() {
+  struct stat st;
+  if (fstat(ringFD, & st) || st.st_size < (off_t) sizeof(rtlsdr_shm_hdr_t)) {
+    std::cerr << "rtlsdr-shm ring is too small\n";
+    return 1;
+  }
+  mapBytes = st.st_size;
+  void * p = mmap(0, mapBytes, PROT_READ, MAP_SHARED, ringFD, 0);
+  if (p == MAP_FAILED) {
+    std::cerr << "unable to map rtlsdr-shm ring\n";
+    return 1;
+  }
+  hdr = (rtlsdr_shm_hdr_t *) p;
+
+  // don't trust anything the producer wrote until it's checked, and
+  // check copies, as the producer can change the mapping at any time
+  uint32_t db = hdr->dataBytes, nm = hdr->numMeta;
+  uint32_t dOff = hdr->dataOffset, mOff = hdr->metaOffset;
+  if (hdr->magic != RTLSDR_SHM_MAGIC || hdr->version != RTLSDR_SHM_VERSION
+      || db < 2 || (db & (db - 1)) || nm == 0 || (nm & (nm - 1))
+      || (uint64_t) dOff + db > mapBytes
+      || (uint64_t) mOff + (uint64_t) nm * sizeof(rtlsdr_shm_meta_t) > mapBytes) {
+    std::cerr << "rtlsdr-shm ring has a bad header\n";
+    return 1;
+  }
+  // from here on, only these copies of the checked fields are used
+  dataBytes = db;
+  numMeta = nm;
+  data = (const unsigned char *) p + dOff;
+  meta = (const rtlsdr_shm_meta_t *) ((const char *) p + mOff);
+  return 0;
+};
+
+uint64_t RTLSDRShmMinder::written() {
+  return __atomic_load_n(& hdr->writeBytes, __ATOMIC_ACQUIRE);
+};
+
+int RTLSDRShmMinder::hw_bufferFrames() {
+  return hdr ? dataBytes / 2 : 0; // hardcoded: 1 byte per sample, two channels (I/Q)
+};
+
+bool RTLSDRShmMinder::hw_is_open() {
+  return hdr != 0;
+};
+
+int RTLSDRShmMinder::hw_do_stop() {
+  // the ring stays mapped; the next start skips whatever is written meanwhile
+  return 0;
+};
+
+void RTLSDRShmMinder::hw_close() {
+  delete_privates();
+};
+
+bool RTLSDRShmMinder::hw_running(double timeNow) {
+  return hdr && timeNow - lastDataReceived < 2.0;
+};
+
+int RTLSDRShmMinder::hw_do_start() {
+  if (! hdr && open())
+    return 1;
+  hasError = 0;
+  clock.reset(hwRate);
+  // start from the newest frame, rather than whatever was left in the ring
+  readBytes = written() & ~ (uint64_t) 1;
+  lastMeta = 0;
+  return 0;
+}
+
+int RTLSDRShmMinder::hw_do_restart() {
+  hasError = 0;
+  return 0;
+};
+
+RTLSDRShmMinder::RTLSDRShmMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now):
+  DevMinder(devName, rate, numChan, 128 * RTLSDRMinder::SAMPLE_SCALE, label, now, RTLSDR_SHM_FRAMES),
+  ctlFD(-1),
+  ringFD(-1),
+  eventFD(-1),
+  hdr(0),
+  mapBytes(0),
+  data(0),
+  meta(0),
+  dataBytes(0),
+  numMeta(0),
+  readBytes(0),
+  lastMeta(0)
+{
+  if (devName.substr(0, 11) != "rtlsdr-shm:")
+    throw std::runtime_error("Invalid name for RTLSDR shared-memory device; must look like 'rtlsdr-shm:PATH'");
+  socketPath = devName.substr(11);
+};
+
+RTLSDRShmMinder::~RTLSDRShmMinder() {
+  stopCaptureThread(); // must not be reading the ring while it is unmapped
+  delete_privates();
+};
+
+int RTLSDRShmMinder::hw_getNumPollFDs () {
+  return eventFD >= 0 ? 1 : 0;
+};
+
+int RTLSDRShmMinder::hw_getPollFDs (struct pollfd *pollfds) {
+  if (eventFD < 0)
+    return 1;
+
+  pollfds->fd = eventFD;
+  pollfds->events = POLLIN;
+  return 0;
+}
+
+int RTLSDRShmMinder::hw_handleEvents ( struct pollfd *pollfds, bool timedOut) {
+  if (eventFD < 0 || timedOut)
+    return 0;
+  if (pollfds->revents & POLLIN) {
+    uint64_t count;
+    // reset the eventfd counter; everything written so far is counted below
+    if (read(eventFD, & count, sizeof(count)) < 0 && errno != EAGAIN)
+      return -errno;
+    return hw_availNow();
+  }
+  return 0;
+};
+
+int RTLSDRShmMinder::hw_availNow () {
+  // return number of frames available, skipping any the producer has
+  // already overwritten.  No syscalls, so sweeps of this device are free
+  // when there's nothing new.
+
+  if (! hdr)
+    return 0;
+  uint64_t behind = written() - readBytes;
+  if (behind > dataBytes) {
+    // lapped: keep only the newer half of the ring, leaving the producer
+    // room to write while we catch up
+    uint64_t skip = (behind - dataBytes / 2) & ~ (uint64_t) 1;
+    noteOverrun(skip / 2, false);
+    frameIndex += skip / 2;
+    readBytes += skip;
+    behind -= skip;
+  }
+  return behind / 2; // hardcoded: 1 byte per sample, two channels (I/Q)
+};
+
+void RTLSDRShmMinder::noteTimestamp() {
+  // the latest chunk's timestamp gives an observation for the clock
+  // whenever it wants one; chunks needn't line up with our reads.
+
+  uint64_t m = __atomic_load_n(& hdr->writeMeta, __ATOMIC_ACQUIRE);
+  if (m == 0 || m == lastMeta)
+    return;
+  rtlsdr_shm_meta_t e = meta[(m - 1) & (numMeta - 1)];
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(& hdr->writeMeta, __ATOMIC_RELAXED) - m >= numMeta - 1)
+    return; // slot may have been rewritten while we copied it
+  long long idx = frameIndex + ((long long) e.byteIndex - (long long) readBytes) / 2;
+  if (clock.wantObservation(idx)) {
+    clock.addObservation(idx, e.ts);
+    lastMeta = m;
+  }
+};
+
+int RTLSDRShmMinder::hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp) {
+  // copy up to numFrames frames from the data ring, in two pieces if
+  // they cross its end.
+
+  if (! hdr)
+    return 0;
+  uint32_t db = dataBytes;
+  uint64_t n = std::min((uint64_t) numFrames, (written() - readBytes) / 2);
+  noteTimestamp();
+
+  uint32_t bytes = 2 * n;
+  uint32_t off = readBytes & (db - 1);
+  uint32_t first = std::min(bytes, db - off);
+  // scale up so sample downsampling using average method maintains more precision.
+  U8Expand::expand(data + off, buf, first, RTLSDRMinder::SAMPLE_SCALE);
+  U8Expand::expand(data, buf + first, bytes - first, RTLSDRMinder::SAMPLE_SCALE);
+
+  // if the producer lapped us while we copied, some of those frames are
+  // newer than they should be; they're kept, but counted
+  if (written() - readBytes > db)
+    corruptReads.add();
+
+  frameTimestamp = clock.ready() ? clock.timestampOf(frameIndex) : 0;
+  readBytes += bytes;
+  frameIndex += n;
+  return n;
+};
+
+void RTLSDRShmMinder::addStatsFields(std::ostream & s) {
+  DevMinder::addStatsFields(s);
+  s << ",\"corruptReads\":" << corruptReads.get();
+};
@@ -0,0 +1,85 @@
+#ifndef RTLSDRSHMMINDER_HPP
+#define RTLSDRSHMMINDER_HPP
+
+#include <string>
+#include <stdexcept>
+#include <sstream>
+#include <sys/types.h>
+
+using namespace std;
+
+#include "DevMinder.hpp"
+#include "RTLSDRShm.hpp"
+
+/*
+  An rtl-sdr device read from a shared-memory ring (see RTLSDRShm.hpp)
+  rather than rtl_tcp's socket.  The device name looks like
+  'rtlsdr-shm:PATH', where PATH is the producer's unix socket.
+*/
+
+class RTLSDRShmMinder : public DevMinder {
+
+protected:
+
+  std::string            socketPath;  // filesystem path to producer's unix domain socket
+  int                    ctlFD;       // connection to producer, kept open so it knows we're still reading; -1 means not connected
+  int                    ringFD;      // fd for the shared ring; -1 means not connected
+  int                    eventFD;     // eventfd the producer writes after publishing each chunk
+  rtlsdr_shm_hdr_t *     hdr;         // start of mapped ring; 0 if not mapped
+  size_t                 mapBytes;    // size of mapping at hdr
+  const unsigned char *  data;        // data ring within the mapping
+  const rtlsdr_shm_meta_t * meta;     // metadata ring within the mapping
+  uint32_t               dataBytes;   // size of data ring, as validated by mapRing; hdr->dataBytes isn't used after that,
+                                      // as the producer could change it
+  uint32_t               numMeta;     // entries in metadata ring, likewise
+  uint64_t               readBytes;   // data ring index of next byte to read
+  uint64_t               lastMeta;    // writeMeta as of the latest timestamp observation
+  StatCounter            corruptReads;// hw_getFrames calls during which the producer overwrote frames being read
+
+public:
+
+  const static int RTLSDR_SHM_FRAMES = 2048;
+
+  virtual int hw_open();
+
+  virtual bool hw_is_open();
+
+  RTLSDRShmMinder(const string &devName, int rate, unsigned int numChan, const string &label, double now);
+
+  ~RTLSDRShmMinder();
+
+  virtual int hw_getNumPollFDs ();
+
+  virtual int hw_getPollFDs (struct pollfd *pollfds);
+
+  virtual int hw_handleEvents ( struct pollfd *pollfds, bool timedOut);
+
+  virtual bool hw_sweepable () {return true;};
+
+  virtual int hw_availNow ();
+
+  virtual int hw_getFrames (int16_t *buf, int numFrames, double & frameTimestamp);
+
+  virtual int hw_bufferFrames ();
+
+  virtual const char * hw_formatName () {return "U8";};
+
+protected:
+
+  virtual void delete_privates();
+  virtual int hw_do_start();
+  virtual int hw_do_stop();
+  virtual void hw_close();
+  virtual int hw_do_restart();
+  virtual bool hw_running(double timeNow);
+
+  void addStatsFields(std::ostream & s);
+
+  int receiveFDs();                   // get ring and eventfd from producer over ctlFD; returns 0 on success
+  int mapRing();                      // map and check the ring; returns 0 on success
+  uint64_t written();                 // producer's writeBytes, with acquire semantics
+  void noteTimestamp();               // feed the latest chunk timestamp to clock, if it wants one
+
+};
+
+#endif // RTLSDRSHMMINDER_HPP
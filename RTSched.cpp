@@ -0,0 +1,165 @@
+#include "RTSched.hpp"
+#include <sys/mman.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sstream>
+
+bool
+RTSched::setPriority(int prio) {
+  if (prio != 0 && (prio < sched_get_priority_min(SCHED_FIFO) || prio > sched_get_priority_max(SCHED_FIFO)))
+    return false;
+  priority = prio;
+  return true;
+};
+
+bool
+RTSched::setCPUs(const std::string & list) {
+  if (list == "all") {
+    haveCPUs = false;
+    cpuList = "";
+    return true;
+  }
+  cpu_set_t set;
+  CPU_ZERO(& set);
+  const char * p = list.c_str();
+  while (*p) {
+    char * end;
+    long lo = strtol(p, & end, 10);
+    if (end == p || lo < 0 || lo >= CPU_SETSIZE)
+      return false;
+    long hi = lo;
+    p = end;
+    if (*p == '-') {
+      ++p;
+      hi = strtol(p, & end, 10);
+      if (end == p || hi < lo || hi >= CPU_SETSIZE)
+        return false;
+      p = end;
+    }
+    for (long c = lo; c <= hi; ++c)
+      CPU_SET(c, & set);
+    if (*p == ',')
+      ++p;
+    else if (*p)
+      return false;
+  }
+  if (CPU_COUNT(& set) == 0)
+    return false;
+  cpus = set;
+  haveCPUs = true;
+  cpuList = list;
+  return true;
+};
+
+bool
+RTSched::lockMemory() {
+  memoryLockRequested = true;
+  // keep freed memory in the process, so that locked, faulted-in pages get reused
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+  memoryLockErr = mlockall(MCL_CURRENT | MCL_FUTURE) ? errno : 0;
+  return memoryLockErr == 0;
+};
+
+void
+RTSched::addThread(const std::string & name, pthread_t tid, bool isWorker) {
+  ThreadInfo & t = threads[name];
+  t.tid = tid;
+  t.isWorker = isWorker;
+  apply(t);
+};
+
+void
+RTSched::removeThread(const std::string & name) {
+  threads.erase(name);
+};
+
+void
+RTSched::applyAll() {
+  for (std::map < std::string, ThreadInfo >::iterator it = threads.begin(); it != threads.end(); ++it)
+    apply(it->second);
+};
+
+void
+RTSched::apply(ThreadInfo & t) {
+  struct sched_param sp;
+  memset(& sp, 0, sizeof(sp));
+  int policy = SCHED_OTHER;
+  if (priority > 0) {
+    policy = SCHED_FIFO;
+    sp.sched_priority = priority;
+    if (t.isWorker && priority > sched_get_priority_min(SCHED_FIFO))
+      --sp.sched_priority;
+  }
+  t.schedErr = pthread_setschedparam(t.tid, policy, & sp);
+
+  cpu_set_t set;
+  if (haveCPUs) {
+    set = cpus;
+  } else {
+    // undo any earlier restriction
+    CPU_ZERO(& set);
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+      CPU_SET(c, & set);
+  }
+  t.affinityErr = pthread_setaffinity_np(t.tid, sizeof(set), & set);
+};
+
+void
+RTSched::prefault(void * p, size_t len) {
+  if (! memoryLockRequested || ! p)
+    return;
+  // write to one byte in each page so the kernel commits it now, rather
+  // than on first use from the capture path
+  static const size_t page = sysconf(_SC_PAGESIZE);
+  volatile char * c = (volatile char *) p;
+  for (size_t i = 0; i < len; i += page)
+    c[i] = c[i];
+  if (len > 0)
+    c[len - 1] = c[len - 1];
+};
+
+std::string
+RTSched::toJSON() {
+  std::ostringstream s;
+  s << "{"
+    << "\"priority\":" << priority << ","
+    << "\"cpus\":\"" << (haveCPUs ? cpuList : "all") << "\","
+    << "\"lockMemory\":" << (memoryLockRequested ? "true" : "false") << ","
+    << "\"memoryLocked\":" << (memoryLockRequested && memoryLockErr == 0 ? "true" : "false");
+  if (memoryLockErr)
+    s << ",\"lockMemoryError\":\"" << strerror(memoryLockErr) << "\"";
+  s << ",\"threads\":{";
+  for (std::map < std::string, ThreadInfo >::iterator it = threads.begin(); it != threads.end(); ++it) {
+    ThreadInfo & t = it->second;
+    int policy = SCHED_OTHER;
+    struct sched_param sp;
+    sp.sched_priority = 0;
+    pthread_getschedparam(t.tid, & policy, & sp);
+    s << (it == threads.begin() ? "" : ",")
+      << "\"" << it->first << "\":{"
+      << "\"policy\":\"" << (policy == SCHED_FIFO ? "fifo" : policy == SCHED_RR ? "rr" : "other") << "\","
+      << "\"priority\":" << sp.sched_priority << ","
+      << "\"schedOkay\":" << (t.schedErr == 0 ? "true" : "false") << ","
+      << "\"affinityOkay\":" << (t.affinityErr == 0 ? "true" : "false");
+    if (t.schedErr)
+      s << ",\"schedError\":\"" << strerror(t.schedErr) << "\"";
+    if (t.affinityErr)
+      s << ",\"affinityError\":\"" << strerror(t.affinityErr) << "\"";
+    s << "}";
+  }
+  s << "}}";
+  return s.str();
+};
+
+// static initializers
+std::map < std::string, RTSched::ThreadInfo > RTSched::threads;
+int RTSched::priority = 0;
+cpu_set_t RTSched::cpus;
+bool RTSched::haveCPUs = false;
+std::string RTSched::cpuList;
+bool RTSched::memoryLockRequested = false;
+int RTSched::memoryLockErr = 0;
@@ -0,0 +1,59 @@
+#ifndef RTSCHED_HPP
+#define RTSCHED_HPP
+
+/*
+  Real-time settings for the threads on the capture path: SCHED_FIFO
+  priority, CPU affinity, and locked, pre-faulted memory.
+
+  Threads are registered by the main thread when they are created, so
+  settings changed later by a command can be re-applied to all of them.
+  The outcome of the most recent attempt is kept for each thread so the
+  host can report whether each setting actually took effect (e.g.
+  SCHED_FIFO needs CAP_SYS_NICE or an rtprio limit).
+
+  Plugin workers get one priority level less than the poll and capture
+  threads, so reading devices always pre-empts running plugins.
+*/
+
+#include <string>
+#include <map>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+
+class RTSched {
+
+public:
+  static bool setPriority(int prio);             // SCHED_FIFO priority; 0 means normal scheduling.  False if out of range.
+  static bool setCPUs(const std::string & list); // e.g. "2,3" or "1-3"; "all" means no restriction.  False if unparseable.
+  static bool lockMemory();                      // lock current and future pages; also stops malloc from returning memory to the OS
+
+  static void addThread(const std::string & name, pthread_t tid, bool isWorker); // register and apply settings to a thread
+  static void removeThread(const std::string & name); // forget a thread; call before it exits
+  static void applyAll();                        // re-apply settings to all registered threads
+
+  static void prefault(void * p, size_t len);    // touch every page of p, if memory locking was requested
+  static bool wantPrefault() {return memoryLockRequested;};
+
+  static std::string toJSON();
+
+protected:
+  typedef struct {
+    pthread_t tid;
+    bool      isWorker;
+    int       schedErr;     // errno from setting the scheduling policy; 0 on success
+    int       affinityErr;  // errno from setting the CPU affinity; 0 on success
+  } ThreadInfo;
+
+  static std::map < std::string, ThreadInfo > threads;
+  static int priority;
+  static cpu_set_t cpus;
+  static bool haveCPUs;          // false means no affinity restriction
+  static std::string cpuList;    // as given to setCPUs
+  static bool memoryLockRequested;
+  static int memoryLockErr;      // errno from mlockall; 0 on success
+
+  static void apply(ThreadInfo & t);
+};
+
+#endif // RTSCHED_HPP
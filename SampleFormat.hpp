@@ -0,0 +1,73 @@
+#ifndef SAMPLEFORMAT_HPP
+#define SAMPLEFORMAT_HPP
+
+/*
+  Hardware sample formats, and conversion from each to the samples the
+  rest of the pipeline carries: S16 for S16 hardware, and S32 for the
+  wider formats, so their extra bits of dynamic range reach plugins and
+  raw outputs rather than being rounded away as frames are read.
+
+  Each format is a class with:
+
+    static const int BYTES;                           // bytes per sample in the hardware's buffer
+    typedef int16_t or int32_t Type;                  // sample type carried by the pipeline
+    static Type convert(const unsigned char *p);      // the sample at p, as Type, at full scale
+
+  Code which converts frames is a template on one of these, so the
+  per-sample loops are compiled separately for each format and have no
+  branches on it; the format is chosen once, when a device is opened.
+*/
+
+#include <stdint.h>
+#include <math.h>
+
+namespace SampleFormat {
+
+  struct S16 {
+    static const int BYTES = 2;
+    typedef int16_t Type;
+    static int16_t convert(const unsigned char *p) {
+      return *(const int16_t *) p;
+    };
+  };
+
+  // 24 bits in the low three bytes of each 32-bit word; the top byte is ignored
+  struct S24 {
+    static const int BYTES = 4;
+    typedef int32_t Type;
+    static int32_t convert(const unsigned char *p) {
+      return (int32_t) (*(const uint32_t *) p << 8);
+    };
+  };
+
+  // 24 bits packed into three bytes, as many USB interfaces deliver them
+  struct S24_3 {
+    static const int BYTES = 3;
+    typedef int32_t Type;
+    static int32_t convert(const unsigned char *p) {
+      return (int32_t) ((p[0] << 8) | (p[1] << 16) | ((uint32_t) p[2] << 24));
+    };
+  };
+
+  struct S32 {
+    static const int BYTES = 4;
+    typedef int32_t Type;
+    static int32_t convert(const unsigned char *p) {
+      return *(const int32_t *) p;
+    };
+  };
+
+  // full scale is [-1, 1]
+  struct FLOAT {
+    static const int BYTES = 4;
+    typedef int32_t Type;
+    static int32_t convert(const unsigned char *p) {
+      // 2^31 isn't an int32, and is the smallest float above INT32_MAX
+      float x = *(const float *) p * 2147483648.0f;
+      return x >= 2147483648.0f ? INT32_MAX : x < -2147483648.0f ? INT32_MIN : (int32_t) lrintf(x);
+    };
+  };
+
+};
+
+#endif // SAMPLEFORMAT_HPP
@@ -0,0 +1,73 @@
+#include "Stats.hpp"
+#include <sstream>
+
+StatHistogram::StatHistogram() :
+  max(0)
+{
+  for (int i = 0; i < NUM_BUCKETS; ++i)
+    buckets[i].store(0, boost::memory_order_relaxed);
+};
+
+void
+StatHistogram::record(uint64_t value) {
+  int b = 0;
+  if (value > 0) {
+    // index of highest set bit, plus one
+    uint64_t v = value;
+    b = 1;
+    if (v >> 32) {
+      b += 32;
+      v >>= 32;
+    }
+    b += 31 - __builtin_clz((uint32_t) v);
+    if (b >= NUM_BUCKETS)
+      b = NUM_BUCKETS - 1;
+  }
+  buckets[b].fetch_add(1, boost::memory_order_relaxed);
+  count.add();
+  sum.add(value);
+  uint64_t m = max.load(boost::memory_order_relaxed);
+  while (value > m && ! max.compare_exchange_weak(m, value, boost::memory_order_relaxed))
+    ;
+};
+
+uint64_t
+StatHistogram::quantile(double q) const {
+  uint64_t n = 0;
+  for (int i = 0; i < NUM_BUCKETS; ++i)
+    n += buckets[i].load(boost::memory_order_relaxed);
+  if (n == 0)
+    return 0;
+  uint64_t target = (uint64_t) (q * n);
+  uint64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    seen += buckets[i].load(boost::memory_order_relaxed);
+    if (seen > target)
+      return i == 0 ? 0 : (i >= 64 ? ~0ULL : (1ULL << i) - 1);
+  }
+  return max.load(boost::memory_order_relaxed);
+};
+
+std::string
+StatHistogram::toJSON() const {
+  std::ostringstream s;
+  uint64_t n = count.get();
+  s << "{\"count\":" << n
+    << ",\"sum\":" << sum.get()
+    << ",\"max\":" << max.load(boost::memory_order_relaxed)
+    << ",\"mean\":" << (n ? (double) sum.get() / n : 0)
+    << ",\"p50\":" << quantile(0.5)
+    << ",\"p99\":" << quantile(0.99)
+    << ",\"buckets\":{";
+  // keyed by the bucket's upper bound (exclusive); empty buckets omitted
+  bool first = true;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    uint32_t c = buckets[i].load(boost::memory_order_relaxed);
+    if (! c)
+      continue;
+    s << (first ? "" : ",") << "\"" << (1ULL << i) << "\":" << c;
+    first = false;
+  }
+  s << "}}";
+  return s.str();
+};
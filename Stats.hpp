@@ -0,0 +1,55 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+/*
+  Lock-free counters and log2-bucket histograms for hot-path metrics.
+
+  Recording is a few relaxed atomic adds, so it can be done from the
+  main thread, capture threads, and plugin workers alike.  Readers
+  (the 'stats' command) see a consistent-enough snapshot; individual
+  fields may be off by the samples recorded while the report is built.
+
+  Histogram bucket i counts values v with 2^(i-1) <= v < 2^i (bucket 0
+  counts zeros), so durations recorded in nanoseconds span 1 ns to
+  ~4 s in 32 buckets.
+*/
+
+#include <string>
+#include <stdint.h>
+#include <time.h>
+#include <boost/atomic.hpp>
+
+class StatCounter {
+public:
+  StatCounter() : v(0) {};
+  void add(uint64_t n = 1) {v.fetch_add(n, boost::memory_order_relaxed);};
+  uint64_t get() const {return v.load(boost::memory_order_relaxed);};
+
+protected:
+  boost::atomic < uint64_t > v;
+};
+
+class StatHistogram {
+public:
+  static const int NUM_BUCKETS = 33;
+
+  StatHistogram();
+  void record(uint64_t value);
+  std::string toJSON() const;  // count, sum, max, approximate quantiles, and non-empty buckets
+
+  static uint64_t nowNS() {     // monotonic clock, for timing with record()
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, & ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  };
+
+protected:
+  boost::atomic < uint32_t > buckets[NUM_BUCKETS];
+  StatCounter count;
+  StatCounter sum;
+  boost::atomic < uint64_t > max;
+
+  uint64_t quantile(double q) const; // upper bound of the bucket holding quantile q
+};
+
+#endif // STATS_HPP
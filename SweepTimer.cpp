@@ -0,0 +1,90 @@
+#include "SweepTimer.hpp"
+#include "DevMinder.hpp"
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+SweepTimer::SweepTimer(const string label, int intervalMS) :
+  Pollable(label),
+  timerFD(-1),
+  intervalMS(intervalMS)
+{
+  // NB: no throwing from here, as Pollable's constructor has already
+  // handed this object to pollables
+
+  intervalMS = std::max((int) MIN_INTERVAL_MS, std::min((int) MAX_INTERVAL_MS, intervalMS));
+  this->intervalMS = intervalMS;
+
+  struct itimerspec its;
+  its.it_interval.tv_sec = intervalMS / 1000;
+  its.it_interval.tv_nsec = (intervalMS % 1000) * 1000000L;
+  its.it_value = its.it_interval;
+
+  timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timerFD < 0 || timerfd_settime(timerFD, 0, & its, 0)) {
+    std::cerr << "unable to start sweep timer; devices will wake the server themselves" << std::endl;
+    if (timerFD >= 0)
+      close(timerFD);
+    timerFD = -1;
+    return;
+  }
+  pollfd.fd = timerFD;
+  pollfd.events = POLLIN;
+  DevMinder::useSweepTimer = true;
+};
+
+SweepTimer::~SweepTimer() {
+  if (timerFD >= 0)
+    close(timerFD);
+};
+
+string SweepTimer::toJSON() {
+  ostringstream s;
+  s << "{"
+    << "\"type\":\"SweepTimer\","
+    << "\"intervalMS\":" << intervalMS << ","
+    << "\"running\":" << (timerFD >= 0 ? "true" : "false") << ","
+    << "\"ticks\":" << ticks.get() << ","
+    << "\"missedTicks\":" << missedTicks.get()
+    << "}";
+  return s.str();
+};
+
+int SweepTimer::getPollFDs (struct pollfd * pollfds) {
+  * pollfds = pollfd;
+  return 0;
+};
+
+void SweepTimer::handleEvents (struct pollfd *pollfds, bool timedOut, double timeNow) {
+  if (timedOut || ! (pollfds->revents & POLLIN))
+    return;
+  uint64_t expirations = 0;
+  if (read(timerFD, & expirations, sizeof(expirations)) < 0 || expirations == 0)
+    return;
+  ticks.add();
+  missedTicks.add(expirations - 1);
+
+  // NB: devices removed during the sweep are only erased from pollables
+  // once the poll round is over, so the iteration is safe
+  uint64_t t0 = StatHistogram::nowNS();
+  int busy = 0;
+  for (PollableSet::iterator is = pollables.begin(); is != pollables.end(); ++is) {
+    DevMinder * dev = dynamic_cast < DevMinder * > (is->second.get());
+    if (! dev)
+      continue;
+    if (dev->sweep(timeNow))
+      ++busy;
+  }
+  devicesPerSweep.record(busy);
+  sweepNS.record(StatHistogram::nowNS() - t0);
+};
+
+void SweepTimer::addStatsFields(std::ostream & s) {
+  s << ",\"ticks\":" << ticks.get()
+    << ",\"missedTicks\":" << missedTicks.get()
+    << ",\"devicesPerSweep\":" << devicesPerSweep.toJSON()
+    << ",\"sweepNS\":" << sweepNS.toJSON();
+};
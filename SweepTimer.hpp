@@ -0,0 +1,49 @@
+#ifndef SWEEPTIMER_HPP
+#define SWEEPTIMER_HPP
+
+/*
+  A timerfd which, each time it fires, reads every device that can be
+  read without polling it (see DevMinder::hw_sweepable), in one pass.
+
+  With many devices, this replaces one main-loop wakeup per period per
+  device with one wakeup per tick, and hands each device's frames to
+  its consumers in a single batch.  The price is up to one tick of
+  extra latency, and the devices' buffers must hold a tick's frames.
+*/
+
+#include "Pollable.hpp"
+
+class SweepTimer : public Pollable {
+
+public:
+  static const int MIN_INTERVAL_MS = 10;
+  static const int MAX_INTERVAL_MS = 100;
+
+  SweepTimer(const string label, int intervalMS); // intervalMS is clamped to [MIN_INTERVAL_MS, MAX_INTERVAL_MS]; sets DevMinder::useSweepTimer if the timer starts
+
+  ~SweepTimer();
+
+  string toJSON();
+
+  int getNumPollFDs() {return timerFD >= 0 ? 1 : 0;};
+
+  int getPollFDs (struct pollfd * pollfds);
+
+  void handleEvents (struct pollfd *pollfds, bool timedOut, double timeNow);
+
+  void stop(double timeNow) {};
+
+  int start(double timeNow) {return 0;};
+
+protected:
+  int               timerFD;
+  int               intervalMS;
+  StatCounter       ticks;           // sweeps done
+  StatCounter       missedTicks;     // ticks which passed without a sweep, because the main loop was busy
+  StatHistogram     devicesPerSweep; // devices which had frames
+  StatHistogram     sweepNS;         // time taken by each sweep
+
+  void addStatsFields(std::ostream & s);
+};
+
+#endif // SWEEPTIMER_HPP
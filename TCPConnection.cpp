@@ -27,6 +27,7 @@ TCPConnection::TCPConnection (int fd, string label, CommandHandler handler, bool
   pollfd.fd = fd;
   pollfd.events = POLLIN | POLLRDHUP;
   outputBuffer = boost::circular_buffer < char > (RAW_OUTPUT_BUFFER_SIZE);
+  prefaultOutput();
   if (! quiet)
     queueOutput(msg);
 };
@@ -99,7 +100,7 @@ void TCPConnection::handleEvents (struct pollfd *pollfds, bool timedOut, double
   }
 
   if (pollfds->revents & (POLLOUT)) {
-    writeSomeOutput(outputBuffer.size());
+    writeSomeOutput(outputSize());
   }
 };
 
@@ -115,6 +116,8 @@ int TCPConnection::start(double timeNow) {
 
 void TCPConnection::setRawOutput(bool yesno) {
   unsigned capacity = yesno ? TCPConnection::RAW_OUTPUT_BUFFER_SIZE : Pollable::DEFAULT_OUTPUT_BUFFER_SIZE;
-  if( capacity != outputBuffer.capacity())
+  if( capacity != outputBuffer.capacity()) {
     outputBuffer = boost::circular_buffer < char > (capacity);
+    prefaultOutput();
+  }
 };
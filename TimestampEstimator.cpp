@@ -0,0 +1,136 @@
+#include "TimestampEstimator.hpp"
+#include <math.h>
+#include <sstream>
+#include <iomanip>
+
+TimestampEstimator::TimestampEstimator() :
+  xs(WINDOW),
+  ys(WINDOW)
+{
+  reset(1.0);
+};
+
+void
+TimestampEstimator::reset(double rate) {
+  nominalRate = rate;
+  refIndex = 0;
+  refTime = 0;
+  numObs = 0;
+  nextObs = 0;
+  lastObsIndex = 0;
+  outliers = 0;
+  totalOutliers = 0;
+  intercept = 0;
+  slope = 1.0 / rate;
+  rms = 0;
+  boost::lock_guard < boost::mutex > lock(snapshotMutex);
+  snapPPM = snapRMS = 0;
+  snapObs = 0;
+  snapOutliers = 0;
+};
+
+bool
+TimestampEstimator::wantObservation(long long frameIndex) {
+  return numObs < MIN_OBS || frameIndex - lastObsIndex >= OBS_INTERVAL * nominalRate;
+};
+
+void
+TimestampEstimator::addObservation(long long frameIndex, double timestamp) {
+  if (numObs == 0) {
+    refIndex = frameIndex;
+    refTime = timestamp;
+  } else if (numObs >= MIN_OBS) {
+    double r = fabs(residualOf(frameIndex, timestamp));
+    if (r > MIN_OUTLIER && r > OUTLIER_SIGMAS * rms) {
+      ++ totalOutliers;
+      if (++ outliers < MAX_OUTLIERS) {
+        boost::lock_guard < boost::mutex > lock(snapshotMutex);
+        snapOutliers = totalOutliers;
+        return;
+      }
+      // the clock has stepped; start over from this observation
+      long long keepOutliers = totalOutliers;
+      reset(nominalRate);
+      totalOutliers = keepOutliers;
+      refIndex = frameIndex;
+      refTime = timestamp;
+    }
+  }
+  outliers = 0;
+  xs[nextObs] = frameIndex - refIndex;
+  ys[nextObs] = timestamp - refTime;
+  nextObs = (nextObs + 1) % WINDOW;
+  if (numObs < WINDOW)
+    ++ numObs;
+  lastObsIndex = frameIndex;
+  fit();
+};
+
+void
+TimestampEstimator::fit() {
+  double mx = 0, my = 0;
+  for (int i = 0; i < numObs; ++i) {
+    mx += xs[i];
+    my += ys[i];
+  }
+  mx /= numObs;
+  my /= numObs;
+
+  double sxx = 0, sxy = 0;
+  for (int i = 0; i < numObs; ++i) {
+    sxx += (xs[i] - mx) * (xs[i] - mx);
+    sxy += (xs[i] - mx) * (ys[i] - my);
+  }
+
+  // until there's enough spread in frame index to give a sensible slope,
+  // use the nominal rate
+  slope = 1.0 / nominalRate;
+  if (numObs >= MIN_OBS && sxx > 0) {
+    double s = sxy / sxx;
+    if (fabs(1.0 / (s * nominalRate) - 1.0) * 1e6 <= MAX_PPM)
+      slope = s;
+  }
+  intercept = my - slope * mx;
+
+  double ss = 0;
+  for (int i = 0; i < numObs; ++i) {
+    double r = ys[i] - (intercept + slope * xs[i]);
+    ss += r * r;
+  }
+  rms = sqrt(ss / numObs);
+
+  boost::lock_guard < boost::mutex > lock(snapshotMutex);
+  snapPPM = (1.0 / (slope * nominalRate) - 1.0) * 1e6;
+  snapRMS = rms;
+  snapObs = numObs;
+  snapOutliers = totalOutliers;
+};
+
+double
+TimestampEstimator::timestampOf(long long frameIndex) {
+  return refTime + intercept + slope * (double) (frameIndex - refIndex);
+};
+
+double
+TimestampEstimator::driftPPM() {
+  boost::lock_guard < boost::mutex > lock(snapshotMutex);
+  return snapPPM;
+};
+
+std::string
+TimestampEstimator::toJSON() {
+  boost::lock_guard < boost::mutex > lock(snapshotMutex);
+  std::ostringstream s;
+  s << "{"
+    << "\"driftPPM\":" << std::setprecision(6) << snapPPM << ","
+    << "\"jitter\":" << snapRMS << ","
+    << "\"observations\":" << snapObs << ","
+    << "\"outliers\":" << snapOutliers
+    << "}";
+  return s.str();
+};
+
+const double TimestampEstimator::OBS_INTERVAL = 1.0;
+const double TimestampEstimator::MAX_PPM = 1000.0;
+const double TimestampEstimator::OUTLIER_SIGMAS = 6.0;
+const double TimestampEstimator::MIN_OUTLIER = 0.005;
@@ -0,0 +1,73 @@
+#ifndef TIMESTAMPESTIMATOR_HPP
+#define TIMESTAMPESTIMATOR_HPP
+
+/*
+  Estimate the system-clock time of any hardware frame from occasional
+  noisy (frame index, timestamp) observations, by a linear regression
+  of timestamp against frame index over a sliding window.
+
+  The slope gives the digitizer's actual rate, and so its drift from
+  the nominal rate in ppm.  Observations only need to be taken every
+  OBS_INTERVAL seconds once the window has MIN_OBS of them, so the
+  expensive timestamp query can be skipped on most periods.
+
+  Observations far from the fitted line are rejected as outliers,
+  unless several arrive in a row, in which case the clock is assumed
+  to have stepped and the fit starts over.
+
+  The estimator is used only by the thread reading the device;
+  a snapshot of its figures is kept under a mutex for toJSON().
+*/
+
+#include <vector>
+#include <string>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+class TimestampEstimator {
+
+public:
+  static const int    WINDOW = 256;       // max number of observations in the fit
+  static const int    MIN_OBS = 8;        // observations taken on every call until there are this many
+  static const double OBS_INTERVAL;       // seconds between observations, once warmed up
+  static const double MAX_PPM;            // fits implying more drift than this are ignored in favour of the nominal rate
+  static const double OUTLIER_SIGMAS;     // reject observations this many RMS residuals from the fit...
+  static const double MIN_OUTLIER;        // ...but never closer than this many seconds
+  static const int    MAX_OUTLIERS = 3;   // this many consecutive outliers means the clock stepped
+
+  TimestampEstimator();
+
+  void reset(double nominalRate);         // forget all observations
+  bool wantObservation(long long frameIndex); // should a timestamp be taken for this frame?
+  void addObservation(long long frameIndex, double timestamp);
+  bool ready() {return numObs > 0;};
+  double timestampOf(long long frameIndex); // estimated timestamp of frame; only valid if ready()
+  double residualOf(long long frameIndex, double timestamp) {return timestamp - timestampOf(frameIndex);};
+
+  std::string toJSON();                   // drift, jitter, and observation count, from the latest snapshot; any thread
+  double driftPPM();                      // from the latest snapshot; any thread
+
+protected:
+  double nominalRate;
+  long long refIndex;           // frame index of first observation; fit is done relative to it
+  double refTime;               // timestamp of first observation
+  std::vector < double > xs;    // frame offsets of observations from refIndex (ring of WINDOW)
+  std::vector < double > ys;    // time offsets of observations from refTime
+  int numObs;                   // observations in xs, ys
+  int nextObs;                  // slot for next observation
+  long long lastObsIndex;       // frame index of latest accepted observation
+  int outliers;                 // consecutive rejected observations
+  long long totalOutliers;
+
+  double intercept, slope;      // current fit: time offset = intercept + slope * frame offset
+  double rms;                   // RMS residual of current fit
+
+  void fit();
+
+  boost::mutex snapshotMutex;   // guards the figures below, which toJSON reports
+  double snapPPM, snapRMS;
+  int snapObs;
+  long long snapOutliers;
+};
+
+#endif // TIMESTAMPESTIMATOR_HPP
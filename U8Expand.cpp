@@ -0,0 +1,38 @@
+#include "U8Expand.hpp"
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define U8EXPAND_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define U8EXPAND_SSE2
+#endif
+
+void
+U8Expand::expand(const unsigned char *src, int16_t *dst, int n, int scale) {
+  int i = 0;
+#if defined(U8EXPAND_NEON)
+  const uint8x8_t bias = vdup_n_u8(128);
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t x = vld1q_u8(src + i);
+    // the wrapped unsigned difference is the signed sample
+    int16x8_t lo = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(x), bias));
+    int16x8_t hi = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(x), bias));
+    vst1q_s16(dst + i,     vmulq_n_s16(lo, scale));
+    vst1q_s16(dst + i + 8, vmulq_n_s16(hi, scale));
+  }
+#elif defined(U8EXPAND_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16(128);
+  const __m128i s = _mm_set1_epi16(scale);
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+    __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(x, zero), bias);
+    __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(x, zero), bias);
+    _mm_storeu_si128((__m128i *) (dst + i),     _mm_mullo_epi16(lo, s));
+    _mm_storeu_si128((__m128i *) (dst + i + 8), _mm_mullo_epi16(hi, s));
+  }
+#endif
+  for (; i < n; ++i)
+    dst[i] = ((int16_t) (int8_t) (src[i] - 128)) * scale;
+};
@@ -0,0 +1,22 @@
+#ifndef U8EXPAND_HPP
+#define U8EXPAND_HPP
+
+/*
+  Widen unsigned 8-bit samples, such as rtl-sdr I/Q, to scaled S16.
+
+  Each byte b becomes (b - 128) * scale.  Sixteen bytes are handled per
+  vector instruction with NEON or SSE2; any remainder is done one at a
+  time.  The input's interleaving is kept, as the decimation tree works
+  on interleaved frames.
+*/
+
+#include <stdint.h>
+
+class U8Expand {
+
+public:
+  // expand n samples from src into dst; dst must not overlap src
+  static void expand(const unsigned char *src, int16_t *dst, int n, int scale);
+};
+
+#endif // U8EXPAND_HPP
@@ -8,6 +8,7 @@
 #include "DevMinder.hpp"
 #include "PluginRunner.hpp"
 #include "WavFileWriter.hpp"
+#include "RTSched.hpp"
 #include <time.h>
 
 VampAlsaHost::VampAlsaHost()
@@ -49,6 +50,20 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
     } else {
       reply << "{\"error\": \"Error: '" << label << "' does not specify a known open device\"}\n";
     }
+  } else if (word == "stats") {
+    string label;
+    if (cmd >> label) {
+      Pollable *p = Pollable::lookupByName(label);
+      if (p)
+        reply << p->statsJSON() << '\n';
+      else
+        reply << "{\"error\": \"Error: '" << label << "' does not specify a known device, plugin, or connection\"}\n";
+    } else {
+      reply << "{\"loop\":" << Pollable::loopStatsJSON();
+      for (PollableSet::iterator ips = Pollable::pollables.begin(); ips != Pollable::pollables.end(); ++ips)
+        reply << ",\"" << ips->second->label << "\":" << ips->second->statsJSON();
+      reply << "}\n";
+    }
   } else if (word == "list") {
     reply << "{";
     int i = Pollable::pollables.size();
@@ -78,18 +93,33 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
     cmd >> rate;
     uint32_t frames = 0;
     cmd >> frames; // this is @ frames for rawFile, FM demod flag for rawStream
+    // the rest of the line is an optional double-quoted path template,
+    // then an optional decimation mode
+    string rest;
+    getline(cmd, rest);
     char path_template [MAX_CMD_STRING_LENGTH + 1];
     path_template[0] = 0;
-    cmd.ignore(MAX_CMD_STRING_LENGTH, '"');
-    cmd.getline(path_template, MAX_CMD_STRING_LENGTH, '"');
+    size_t q1 = rest.find('"'), q2 = string::npos;
+    if (q1 != string::npos && (q2 = rest.find('"', q1 + 1)) != string::npos) {
+      rest.copy(path_template, std::min(q2 - q1 - 1, (size_t) MAX_CMD_STRING_LENGTH), q1 + 1);
+      path_template[std::min(q2 - q1 - 1, (size_t) MAX_CMD_STRING_LENGTH)] = 0;
+      rest.erase(0, q2 + 1);
+    }
+    string decimName;
+    istringstream(rest) >> decimName;
 
     DevMinder *p = dynamic_cast < DevMinder * > (Pollable::lookupByName(label));
-    if (p) {
+    DownSampler::Mode decimMode;
+    if (p && decimName.length() == 0) {
+      decimMode = p->getDecimMode();
+    } else if (p && ! DownSampler::modeFromName(decimName, decimMode)) {
+      reply << "{\"error\": \"Error: DECIM must be one of 'sub', 'avg', or 'fir'\"}\n";
+    } else if (p) {
       if (word == "rawStream") {
         // set fm on/off and add a raw listener
         // cancelling the listen will close the connection.
         p->setDemodFMForRaw(frames);
-        p->addRawListener(connLabel, round(p->hwRate / rate), true);
+        p->addRawListener(connLabel, round(p->hwRate / rate), true, decimMode);
       } else if (word == "rawStreamOff") {
         p->removeRawListener(connLabel);
       } else if (word == "rawFile" || word == "rawFileOff") {
@@ -104,8 +134,8 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
             if (wav) {
               wav->resumeWithNewFile(path_template);
             } else {
-              new WavFileWriter (label, wavLabel, path_template, frames, rate, p->numChan);
-              p->addRawListener(wavLabel, round(p->hwRate / rate));
+              new WavFileWriter (label, wavLabel, path_template, frames, rate, p->rawChannels(), p->rawSampleBytes());
+              p->addRawListener(wavLabel, round(p->hwRate / rate), false, decimMode);
             }
           }
         } else {
@@ -127,11 +157,43 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
       reply << "{\"error\": \"Error: LABEL does not specify a known open device\"}\n";
     }
   } else if (word == "open" ) {
-    string label, alsaDev;
+    string label, alsaDev, decimName, opt, format;
     int rate, numChan;
+    int periodFrames = 0, bufferFrames = 0;
+    double wakeups = 0;
     cmd >> label >> alsaDev >> rate >> numChan;
+    DownSampler::Mode decimMode = DownSampler::DS_SUBSAMPLE;
     try {
-      DevMinder * ptr = DevMinder::getDevMinder(alsaDev, rate, numChan, label, realTimeNow);
+      while (cmd >> opt) {
+        size_t eq = opt.find('=');
+        if (eq == string::npos) {
+          if (decimName.length() > 0)
+            throw std::runtime_error(string("unexpected argument '") + opt + "'");
+          decimName = opt;
+          continue;
+        }
+        string name = opt.substr(0, eq);
+        if (name == "format") {
+          format = opt.substr(eq + 1);
+          continue;
+        }
+        double val = atof(opt.c_str() + eq + 1);
+        if (val <= 0)
+          throw std::runtime_error(string("value for '") + name + "' must be positive");
+        if (name == "period")
+          periodFrames = (int) val;
+        else if (name == "buffer")
+          bufferFrames = (int) val;
+        else if (name == "wakeups")
+          wakeups = val;
+        else
+          throw std::runtime_error(string("unknown option '") + name + "'");
+      }
+      if (periodFrames > 0 && wakeups > 0)
+        throw std::runtime_error("specify at most one of period= and wakeups=");
+      if (decimName.length() > 0 && ! DownSampler::modeFromName(decimName, decimMode))
+        throw std::runtime_error("DECIM must be one of 'sub', 'avg', or 'fir'");
+      DevMinder * ptr = DevMinder::getDevMinder(alsaDev, rate, numChan, label, realTimeNow, decimMode, periodFrames, bufferFrames, wakeups, format);
       reply << ptr->toJSON() << '\n';
     } catch (std::runtime_error& e) {
       reply << "{\"error\": \"Error:" << e.what() << "\"}\n";
@@ -153,9 +215,17 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
     string par;
     float val;
     ParamSet ps;
+    int pluginRate = 0;
     cmd >> devLabel >> pluginLabel >> pluginLib >> pluginName >> outputName;
     for (;;) {
-      if (! (cmd >> par >> val))
+      if (! (cmd >> par))
+        break;
+      if (par[0] == '@') {
+        // the plugin wants its own rate
+        pluginRate = atoi(par.c_str() + 1);
+        continue;
+      }
+      if (! (cmd >> val))
         break;
       ps[par] = val;
     }
@@ -165,7 +235,11 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
         throw std::runtime_error(string("There is no device with label '") + devLabel + "'");
       if (Pollable::lookupByName(pluginLabel))
         throw std::runtime_error(string("There is already a device or plugin with label '") + pluginLabel + "'");
-      new PluginRunner(pluginLabel, devLabel, dev->rate, dev->numChan, dev->maxSampleAbs, pluginLib, pluginName, outputName, ps);
+      if (pluginRate == 0)
+        pluginRate = dev->rate;
+      if (pluginRate < 0 || pluginRate > (int) dev->hwRate || dev->hwRate % pluginRate != 0)
+        throw std::runtime_error("@RATE must divide the device's hardware rate");
+      new PluginRunner(pluginLabel, devLabel, pluginRate, dev->numChan, dev->maxSampleAbs, pluginLib, pluginName, outputName, ps);
       boost::shared_ptr < PluginRunner > plugin = boost::static_pointer_cast < PluginRunner > (Pollable::lookupByNameShared(pluginLabel));
       dev->addPluginRunner(pluginLabel, plugin);
       if (! plugin->addOutputListener(defaultOutputListener))
@@ -213,7 +287,7 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
           boost::shared_ptr < DevMinder > sdm = boost::dynamic_pointer_cast < DevMinder > (jp->second);
           DevMinder *dm = sdm.get();
           if (dm) {
-            dm->removeRawListener(pluginLabel);
+            dm->removePluginRunner(pluginLabel);
           }
         }
       };
@@ -244,6 +318,32 @@ string VampAlsaHost::runCommand(string cmdString, string connLabel) {
         ptr->addOutputListener(connLabel);
       defaultOutputListener = connLabel;
     }
+  } else if (word == "realtime") {
+    // any of: priority PRIO, cpus LIST, lock; then report
+    string what;
+    bool okay = true;
+    while (okay && cmd >> what) {
+      if (what == "priority") {
+        int prio = -1;
+        okay = (cmd >> prio) && RTSched::setPriority(prio);
+        if (! okay)
+          reply << "{\"error\": \"Error: invalid SCHED_FIFO priority\"}\n";
+      } else if (what == "cpus") {
+        string list;
+        okay = (cmd >> list) && RTSched::setCPUs(list);
+        if (! okay)
+          reply << "{\"error\": \"Error: invalid CPU list\"}\n";
+      } else if (what == "lock") {
+        RTSched::lockMemory();
+      } else {
+        okay = false;
+        reply << "{\"error\": \"Error: unknown realtime setting '" << what << "'\"}\n";
+      }
+    }
+    if (okay) {
+      RTSched::applyAll();
+      reply << RTSched::toJSON() << '\n';
+    }
   } else if (word == "quit" ) {
     reply << "{\"message\": \"Terminating server.\"}\n";
     throw std::runtime_error("Quit by client.\n");
@@ -274,7 +374,7 @@ VampAlsaHost::now(bool is_monotonic) {
 
 const string
 VampAlsaHost::commandHelp =
-          "       open DEV_LABEL AUDIO_DEV RATE NUM_CHANNELS\n"
+          "       open DEV_LABEL AUDIO_DEV RATE NUM_CHANNELS [DECIM] [period=FRAMES] [buffer=FRAMES] [wakeups=N] [format=FMT]\n"
           "          Opens an audio device so that plugins can be attached to it.\n"
           "          To start processing, you must attach a plugin and start the device\n"
           "          using the 'start DEV_LABEL' command - see below\n\n"
@@ -283,11 +383,49 @@ VampAlsaHost::commandHelp =
           "             and in output lines.  This must not already be a label of another device\n"
           "             or a plugin instance (see below).\n"
           "          AUDIO_DEV: the ALSA name of the audio device (e.g. 'default:CARD=V10')\n"
+          "             or 'rtlsdr:PATH' for rtl_tcp's unix socket at PATH, or 'rtlsdr-shm:PATH' for\n"
+          "             a producer offering a shared-memory ring (see RTLSDRShm.hpp) on the unix socket\n"
+          "             at PATH.  The latter's period, buffer, and format are set by the producer.\n"
+          "             Or 'chan:DEV_LABEL:N:K' for channel K of N split from the I/Q device DEV_LABEL\n"
+          "             by a polyphase filter bank: channel K is centred K/N of DEV_LABEL's hardware rate\n"
+          "             above its centre (K >= N/2 are below it), with a hardware rate 1/N of DEV_LABEL's.\n"
+          "             N must be a power of two, and the same for all channels of DEV_LABEL.  The\n"
+          "             channel receives frames only while both it and DEV_LABEL are started.\n"
+          "             Or 'file:PATH' to replay a recording at the rate it was made, or 'filefast:PATH'\n"
+          "             to replay it as fast as its plugins and raw listeners keep up.  PATH is a .WAV file\n"
+          "             of S16_LE or S32_LE samples (e.g. from rawFile), or raw samples recorded at RATE:\n"
+          "             S16_LE, or S32_LE or U8 (e.g. from rtl_sdr) with format=.  Frame timestamps start\n"
+          "             from seconds since the epoch in PATH.ts, or else a date and time like\n"
+          "             2024-05-01T12-34-56.789 (UTC) in PATH's name, or else PATH's modification time less\n"
+          "             its duration.  At the end of the file the device stops and sends a devEOF event;\n"
+          "             starting it again replays the file from the beginning.\n"
           "          RATE: the sampling rate to use for the device (e.g. 48000)\n"
-          "          NUM_CHANNELS: the number of channels to read from the device (usually 1 or 2)\n\n"
-          "          e.g. open 3 default:CARD=V10_2 48000 2\n\n"
-
-          "       attach DEV_LABEL PLUGIN_LABEL PLUGIN_SONAME PLUGIN_ID PLUGIN_OUTPUT [PAR VALUE]*\n"
+          "          NUM_CHANNELS: the number of channels to read from the device (1 to 8; usually 1 or 2)\n"
+          "          DECIM: how to downsample from the hardware rate to RATE, and to raw output rates:\n"
+          "             'sub' (default): keep every Nth frame; cheapest, but aliases\n"
+          "             'avg': average N frames; attenuates, but doesn't remove, aliases\n"
+          "             'fir': CIC filter followed by a polyphase FIR filter; nearly alias-free\n"
+          "          period=FRAMES: hardware frames per period; the device wakes us once per period.\n"
+          "             Longer periods mean fewer wakeups and less power; shorter ones mean less latency.\n"
+          "             (default: 4800; for file devices, a tenth of a second)  Not for rtlsdr or rtlsdr-shm devices.\n"
+          "          wakeups=N: instead of period=, choose the period giving about N wakeups per second.\n"
+          "          buffer=FRAMES: hardware frames the device can hold before frames are lost; at least\n"
+          "             two periods.  For rtlsdr devices, this sizes the socket's receive buffer.\n"
+          "             (default: 131072 for audio devices; the system default for rtlsdr)\n"
+          "          format=FMT: the device's sample format: one of S16_LE, S24_3LE, S24_LE, S32_LE, FLOAT_LE\n"
+          "             (default: the first of those the device offers).  S16_LE samples are used as they\n"
+          "             are; the wider formats are converted to S32_LE as they are read, keeping their full\n"
+          "             dynamic range for plugins, and raw output from such a device is S32_LE.  So a device\n"
+          "             needn't be opened through ALSA's 'plug' layer just to get S16_LE.\n"
+          "             For file devices, FMT is S16_LE, S32_LE, or U8.\n"
+          "          The sizes and format actually used are reported as periodFrames, bufferFrames,\n"
+          "          and format, and the format of raw output as rawFormat.\n\n"
+          "          e.g. open 3 default:CARD=V10_2 48000 2\n"
+          "               open 4 default:CARD=V10_3 48000 2 avg wakeups=5 buffer=96000\n"
+          "               open 5c3 chan:5:16:3 50000 2\n"
+          "               open r1 filefast:/data/2024-05-01T12-34-56.789.wav 48000 2\n\n"
+
+          "       attach DEV_LABEL PLUGIN_LABEL PLUGIN_SONAME PLUGIN_ID PLUGIN_OUTPUT [@RATE] [PAR VALUE]*\n"
           "          Load the specified plugin and attach it to the specified audio device.  Multiple plugins\n"
           "          can be attached to the same device.  All incoming data is sent to all attached\n"
           "          plugins, in the same order in which they were attached.\n"
@@ -298,6 +436,9 @@ VampAlsaHost::commandHelp =
           "          PLUGIN_ID: the name of the plugin within the library\n"
           "          PLUGIN_OUTPUT: the name of the desired output from the plugin\n"
           "                         (some plugins have multiple outputs - you must pick one)\n"
+          "          [@RATE]: optional rate at which the plugin receives frames; must divide the\n"
+          "                   device's hardware rate.  Defaults to the rate given to 'open'.\n"
+          "                   Consumers wanting the same rate share one downsampled stream.\n"
           "          [PAR VALUE]: an optional set of plugin parameter settings, where:\n"
           "                       PAR: is the name of a plugin parameter\n"
           "                       VALUE: is the value to be assiged to the parameter\n\n"
@@ -335,7 +476,7 @@ VampAlsaHost::commandHelp =
           "          connections already receiving data from an attached plugin.\n"
           "          Note: this command does not return a reply unless there is an error.\n\n"
 
-          "       rawStream DEV_LABEL RATE FRAMES\n"
+          "       rawStream DEV_LABEL RATE FRAMES [DECIM]\n"
           "          Write raw data to the TCP connection.\n"
           "          DEV_LABEL: the device from which to obtain raw data\n"
           "          RATE:   the frame rate to use.  The actual frame rate will be the closest frame rate which\n"
@@ -345,8 +486,9 @@ VampAlsaHost::commandHelp =
           "                  which issued the rawFile command.\n"
           "          If an error occurs when writing to a file, VAH will print a message of the form\n"
           "                  {\"message\": \"rawError\", \"dev\": \"DEV_LABEL\", \"errno\": errno} to the TCP connection\n"
+          "          DECIM: how to downsample; see the 'open' command.  Defaults to the device's DECIM.\n\n"
 
-          "       rawFile DEV_LABEL RATE FRAMES PATH_TEMPLATE\n"
+          "       rawFile DEV_LABEL RATE FRAMES PATH_TEMPLATE [DECIM]\n"
           "          Write queued raw data to a file or the TCP connection.\n"
           "          DEV_LABEL: the device from which to obtain raw data; nothing is written until a rawOn\n"
           "                  command has been issued for this device.\n"
@@ -360,7 +502,8 @@ VampAlsaHost::commandHelp =
           "                  and immediately begins writing to the new file.\n"
           "          PATH_TEMPLATE: the template for a full pathname of the file to write; strftime format codes\n"
           "                  will be replaced by the real timestamp of the first frame written.\n"
-          "                  If not specified, data will be written directly to the TCP connection.\n\n"
+          "                  If not specified, data will be written directly to the TCP connection.\n"
+          "          DECIM: how to downsample; see the 'open' command.  Defaults to the device's DECIM.\n\n"
           "          If an error occurs when writing to a file, VAH will print a message of the form\n"
           "                  {\"message\": \"rawError\", \"dev\": \"DEV_LABEL\", \"errno\": errno} to the TCP connection\n"
 
@@ -413,6 +556,18 @@ VampAlsaHost::commandHelp =
           "           Report on the status of plugin identified by LABEL\n"
           "           The reply is a JSON object.\n\n"
 
+          "       stats [LABEL]\n"
+          "           Report hot-path metrics for the device, plugin, or connection identified by LABEL,\n"
+          "           or for the event loop and everything, if LABEL is omitted.  The reply is a JSON object.\n"
+          "           Histograms have count, sum, max, mean, approximate p50 and p99, and counts in\n"
+          "           power-of-two buckets keyed by their (exclusive) upper bound.  Times are in nanoseconds.\n"
+          "           Every object has queuedBytes, droppedBytes, and waitingBytes for its output.  Devices add\n"
+          "           totalFrames, framesPerEvent, getFramesNS, decimNS, demodNS, channelizeNS (splitting\n"
+          "           into chan: devices), startNS, fastStarts, and fullStarts, then by type: wrappedReads\n"
+          "           (ALSA), recvCalls and recvBytes (rtlsdr), corruptReads (rtlsdr-shm), and backlogWaits,\n"
+          "           fileFrames, and filePos (file).  Plugins add totalFrames, totalFeatures, droppedBlocks,\n"
+          "           and processNS.\n\n"
+
           "       stopAll\n"
           "           Stop all devices, e.g. to allow changing settings on upstream devices.\n"
 
@@ -422,6 +577,15 @@ VampAlsaHost::commandHelp =
           "       list\n"
           "           Return the status of all open audio devices and plugins.\n\n"
 
+          "       realtime [priority PRIO] [cpus CPU_LIST] [lock]\n"
+          "           Change real-time settings for the poll, capture, and plugin worker threads,\n"
+          "           then report the settings and whether each took effect on each thread.\n"
+          "           PRIO: SCHED_FIFO priority (1-99), or 0 for normal scheduling.  Plugin workers\n"
+          "                 run one level lower, so reading devices pre-empts plugins.\n"
+          "           CPU_LIST: CPUs the threads may run on, e.g. 2,3 or 1-3; 'all' removes the restriction.\n"
+          "           lock: lock all current and future memory of the process into RAM.\n"
+          "           With no arguments, just report.\n\n"
+
           "       help\n"
           "           Print this information.\n\n"
 
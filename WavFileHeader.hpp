@@ -1,6 +1,6 @@
 /*
-  Header and header-filler for .WAV files
-  FIXME: currently hard-coded to S16_LE sample format
+  Header and header-filler for .WAV files of integer PCM samples:
+  S16_LE by default, or S32_LE for wide devices' raw output
 */
 
 #ifndef WAVFILEHEADER_HPP
@@ -30,7 +30,8 @@ protected:
 public:
 
   const static int BITS_PER_SAMPLE_S16_LE = 16;
-  const static int SAMPLE_FMT_CODE_PCM_S16_LE = 1;
+  const static int BITS_PER_SAMPLE_S32_LE = 32;
+  const static int SAMPLE_FMT_CODE_PCM_S16_LE = 1; // also the code for other integer PCM sizes
 
   WavFileHeader(int rate, int channels, uint32_t frames, int bitsPerSample = BITS_PER_SAMPLE_S16_LE, int fmtCode = SAMPLE_FMT_CODE_PCM_S16_LE)
   {
@@ -40,12 +41,12 @@ public:
     hdrBuf.remFileSize = bytes + 36;
     memcpy(hdrBuf.WAVElabel, "WAVE", 4);
     memcpy(hdrBuf.FMTlabel, "fmt ", 4);
-    hdrBuf.remFmtSize = bitsPerSample;
+    hdrBuf.remFmtSize = 16; // bytes of fmt chunk after this field
     hdrBuf.fmtCode = fmtCode;
     hdrBuf.numChan = channels;
     hdrBuf.sampleRate = rate;
     hdrBuf.byteRate = rate * channels * bitsPerSample / 8;
-    hdrBuf.frameSize = channels * 2;
+    hdrBuf.frameSize = channels * bitsPerSample / 8;
     hdrBuf.sampleSize = bitsPerSample;
     memcpy(hdrBuf.DATAlabel, "data", 4);
     hdrBuf.remDataSize = bytes;
@@ -1,4 +1,5 @@
 #include "WavFileWriter.hpp"
+#include "DevMinder.hpp"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -13,27 +14,29 @@
 
 #include <unistd.h>
 
-WavFileWriter::WavFileWriter (string &portLabel, string &label, char *pathTemplate, uint32_t framesToWrite, int rate, int channels) :
+WavFileWriter::WavFileWriter (string &portLabel, string &label, char *pathTemplate, uint32_t framesToWrite, int rate, int channels, int sampleBytes) :
   Pollable(label),
   portLabel(portLabel),
   pathTemplate(pathTemplate),
   framesToWrite(framesToWrite),
-  bytesToWrite(framesToWrite * 2 * channels), // FIXME: mono S16_LE hardcoded here
-  byteCountdown(framesToWrite * 2 * channels),
+  bytesToWrite(framesToWrite * sampleBytes * channels),
+  byteCountdown(framesToWrite * sampleBytes * channels),
   currFileTimestamp(-1),
   prevFileTimestamp(-1),
-  hdr(rate, channels, framesToWrite),
+  hdr(rate, channels, framesToWrite, 8 * sampleBytes),
   headerWritten(false),
   timestampCaptured(false),
   totalFilesWritten(0),
   totalSecondsWritten(0),
   ensureDirsState(DIR_STATE_NONE),
   rate(rate),
-  channels(channels)
+  channels(channels),
+  sampleBytes(sampleBytes)
 {
   pollfd.fd = -1;
   pollfd.events = 0;
   outputBuffer = boost::circular_buffer < char > (OUTPUT_BUFFER_SIZE);
+  prefaultOutput();
   filename[0]=0;
 };
 
@@ -49,32 +52,49 @@ int WavFileWriter::getPollFDs (struct pollfd * pollfds) {
 bool WavFileWriter::queueOutput(const char *p, uint32_t len, double timestamp) {
   // if we've already opened a file, drop samples that would overflow the
   // buffer
-  if (timestampCaptured) {
-    len = std::min((uint32_t) outputBuffer.reserve(), len);
+  if (timestampCaptured && len > outputReserve()) {
+    droppedBytes.add(len - outputReserve());
+    len = outputReserve();
   }
 
   if (len == 0)
     return false;
 
-  // get the timestamp for the last frame we're adding, from the timestamp
-  // for the first frame.   FIXME: hardcoded assumption of S16_LE
+  bool rv = Pollable::queueOutput(p, len);
+  outputAdded(len, timestamp);
+  return rv;
+};
 
-  lastFrameTimestamp = (len - 2 * channels) / (2.0 * channels * rate) + timestamp;
+bool WavFileWriter::queueOutput(const OutputBlock::Ptr &blk, double timestamp) {
+  // a block which only partly fits has to be truncated, which means copying it
+  if (timestampCaptured && blk->size() > outputReserve())
+    return queueOutput(blk->data(), blk->size(), timestamp);
 
-  bool rv = Pollable::queueOutput(p, len);
+  if (blk->size() == 0)
+    return false;
+
+  bool rv = Pollable::queueOutput(blk);
+  outputAdded(blk->size(), timestamp);
+  return rv;
+};
+
+void WavFileWriter::outputAdded(uint32_t len, double timestamp) {
+  // get the timestamp for the last frame we've added, from the timestamp
+  // for the first frame.
+
+  int frameBytes = sampleBytes * channels;
+  lastFrameTimestamp = (len - frameBytes) / ((double) frameBytes * rate) + timestamp;
 
   if (pollfd.fd < 0)
-    openOutputFile(lastFrameTimestamp - outputBuffer.size() / (2.0 * channels * rate));
+    openOutputFile(lastFrameTimestamp - outputSize() / ((double) frameBytes * rate));
 
   // only set this fd up for output polling if there's MIN_WRITE_SIZE data
   // otherwise, we're calling write() much too often
 
-  if ((int) outputBuffer.size() >= MIN_WRITE_SIZE || byteCountdown < MIN_WRITE_SIZE)
+  if ((int) outputSize() >= MIN_WRITE_SIZE || byteCountdown < MIN_WRITE_SIZE)
     pollfd.events |= POLLOUT;
   else
     pollfd.events &= ~POLLOUT;
-
-  return rv;
 };
 
 void WavFileWriter::openOutputFile(double first_timestamp) {
@@ -140,7 +160,7 @@ void WavFileWriter::doneOutputFile(int err) {
     close(pollfd.fd);
     pollfd.fd = -1;
     ++totalFilesWritten;
-    prevSecondsWritten = (bytesToWrite - byteCountdown) / (2.0 * channels * rate); // FIXME: hardwired S16_LE format
+    prevSecondsWritten = (bytesToWrite - byteCountdown) / ((double) sampleBytes * channels * rate);
     totalSecondsWritten += prevSecondsWritten;
   }
   requestPollFDRegen();
@@ -177,7 +197,7 @@ void WavFileWriter::handleEvents (struct pollfd *pollfds, bool timedOut, double
       }
       return;
     }
-    int len = outputBuffer.size();
+    int len = outputSize();
     int nb = writeSomeOutput(std::min(byteCountdown, len));
     byteCountdown -= nb;
     if (nb < 0 || byteCountdown == 0)
@@ -211,16 +231,20 @@ string WavFileWriter::toJSON() {
     << ",\"port\":\"" << portLabel
     << "\",\"fileDescriptor\":" << pollfd.fd
     << ",\"fileName\":\"" << (char *) filename
-    << "\",\"framesWritten\":" << (uint32_t) ((bytesToWrite - byteCountdown) / (2 * channels))
+    << "\",\"framesWritten\":" << (uint32_t) ((bytesToWrite - byteCountdown) / (sampleBytes * channels))
     << ",\"framesToWrite\":" << framesToWrite
-    << ",\"secondsWritten\":"  << std::setprecision(16) << ((bytesToWrite - byteCountdown) / (2.0 * rate * channels))
+    << ",\"secondsWritten\":"  << std::setprecision(16) << ((bytesToWrite - byteCountdown) / ((double) sampleBytes * rate * channels))
     << ",\"secondsToWrite\":" << framesToWrite / (double) rate
     << ",\"totalFilesWritten\":" << totalFilesWritten
     << ",\"totalSecondsWritten\":" << totalSecondsWritten
     << ",\"prevFileTimestamp\":" << prevFileTimestamp
     << ",\"currFileTimestamp\":" << currFileTimestamp
     << ",\"prevSecondsWritten\":" << prevSecondsWritten
-    << ",\"rate\":" << rate
-    << "}";
+    << ",\"rate\":" << rate;
+  // the device's estimate of its digitizer clock drift, for correcting file durations
+  DevMinder * dev = dynamic_cast < DevMinder * > (Pollable::lookupByName(portLabel));
+  if (dev)
+    s << ",\"clockDriftPPM\":" << dev->getDriftPPM();
+  s << "}";
   return s.str();
 };
@@ -26,7 +26,7 @@ protected:
   int32_t byteCountdown; // number of bytes remaining to write
   double lastFrameTimestamp;
   double currFileTimestamp; // timestamp of first sample of current file
-  double prevFileTimestamp; // timestamp of first sample of previously written file, for calculating mic digitizer clock bias
+  double prevFileTimestamp; // timestamp of first sample of previously written file; superseded by the device's clock drift estimate, but kept for older clients
   double prevSecondsWritten; // number of seconds written to previous file at nominal rate
   WavFileHeader hdr; // buffer to store header
   bool headerWritten; // has a header been written to the current output file?
@@ -40,13 +40,14 @@ protected:
   uint64_t totalSecondsWritten;  // for all completed files
 
   void openOutputFile(double firstTimestamp);
+  void outputAdded(uint32_t len, double timestamp); // note timestamp of newly queued output
   void doneOutputFile(int err = 0);
 
   static void ensureDirs(WavFileWriter *wav); // function called in separate thread to ensure directories for to-be-opened file are open
   enum {DIR_STATE_NONE, DIR_STATE_WAITING, DIR_STATE_CREATED} ensureDirsState; // state of directory creation
 public:
 
-  WavFileWriter (string &portLabel, string &label, char *pathTemplate, uint32_t framesToWrite, int rate, int channels);
+  WavFileWriter (string &portLabel, string &label, char *pathTemplate, uint32_t framesToWrite, int rate, int channels, int sampleBytes = 2); // sampleBytes: 2 for S16_LE, 4 for S32_LE
   
   int getNumPollFDs();
 
@@ -55,6 +56,8 @@ public:
   int getOutputFD(){return 0;}; 
 
   bool queueOutput(const char *p, uint32_t len, double timestamp = 0);
+
+  bool queueOutput(const OutputBlock::Ptr &blk, double timestamp = 0);
     
   void handleEvents (struct pollfd *pollfds, bool timedOut, double timeNow);
 
@@ -69,6 +72,8 @@ public:
   int rate;
 
   int channels;
+
+  int sampleBytes; // bytes per sample: 2 (S16_LE) or 4 (S32_LE)
 };
 
 #endif // WAVFILEWRITER_HPP
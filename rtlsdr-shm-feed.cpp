@@ -0,0 +1,263 @@
+/*
+  rtlsdr-shm-feed: a stand-in for an rtl-sdr producer writing the
+  shared-memory ring described in RTLSDRShm.hpp, for testing
+  rtlsdr-shm: devices without a dongle.
+
+  Usage: rtlsdr-shm-feed SOCKET_PATH [RATE [FILE [RING_BYTES]]]
+
+  Listens on the unix socket SOCKET_PATH, and writes RATE (default
+  2400000) I/Q frames per second into the ring, in 10 ms chunks paced
+  by the system clock.  The frames come from FILE, raw unsigned 8-bit
+  I/Q as written by rtl_sdr and replayed in a loop, or if FILE is
+  missing or '-', a tone at RATE / 8 with a little noise.  RING_BYTES
+  (default 4194304) is rounded up to a power of two.
+
+  Then e.g. 'open rtl1 rtlsdr-shm:SOCKET_PATH 48000 2'
+*/
+
+#include "RTLSDRShm.hpp"
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+static const int CHUNKS_PER_SECOND = 100;
+static const uint32_t NUM_META = 1024;
+
+typedef struct {
+  int sock;     // connection to client; used only to notice when it goes away
+  int event;    // eventfd we write after each chunk
+} Client;
+
+static double
+realNow() {
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+static int
+makeRing(size_t bytes) {
+  int fd = -1;
+#ifdef SYS_memfd_create
+  fd = syscall(SYS_memfd_create, "rtlsdr-shm-feed", 0);
+#endif
+  if (fd < 0) {
+    // older kernel: use an unlinked file in tmpfs
+    char name[] = "/dev/shm/rtlsdr-shm-feed-XXXXXX";
+    fd = mkstemp(name);
+    if (fd < 0)
+      return -1;
+    unlink(name);
+  }
+  if (ftruncate(fd, bytes) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool
+sendFDs(int sock, int ringFD, int eventFD) {
+  char byte = 0;
+  struct iovec iov = {& byte, 1};
+  union {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  struct msghdr msg;
+  memset(& msg, 0, sizeof(msg));
+  memset(& ctl, 0, sizeof(ctl));
+  msg.msg_iov = & iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl.buf;
+  msg.msg_controllen = sizeof(ctl.buf);
+  struct cmsghdr * c = CMSG_FIRSTHDR(& msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(2 * sizeof(int));
+  int fds[2] = {ringFD, eventFD};
+  memcpy(CMSG_DATA(c), fds, sizeof(fds));
+  return sendmsg(sock, & msg, MSG_NOSIGNAL) == 1;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: rtlsdr-shm-feed SOCKET_PATH [RATE [FILE [RING_BYTES]]]\n";
+    return 1;
+  }
+  const char * path = argv[1];
+  uint32_t rate = argc > 2 ? atoi(argv[2]) : 2400000;
+  const char * file = argc > 3 && strcmp(argv[3], "-") ? argv[3] : 0;
+  uint32_t dataBytes = 4096;
+  uint32_t want = argc > 4 ? atoi(argv[4]) : 4194304;
+  while (dataBytes < want)
+    dataBytes *= 2;
+  if (rate < CHUNKS_PER_SECOND) {
+    std::cerr << "RATE must be at least " << CHUNKS_PER_SECOND << "\n";
+    return 1;
+  }
+
+  // the samples to send: one second of tone, or the whole file
+
+  std::vector < unsigned char > source;
+  if (file) {
+    FILE * f = fopen(file, "rb");
+    if (! f) {
+      std::cerr << "can't open " << file << "\n";
+      return 1;
+    }
+    unsigned char b[65536];
+    size_t n;
+    while ((n = fread(b, 1, sizeof(b), f)) > 0)
+      source.insert(source.end(), b, b + n);
+    fclose(f);
+    source.resize(source.size() & ~ (size_t) 1);
+  } else {
+    source.resize(2 * rate);
+    for (uint32_t i = 0; i < rate; ++i) {
+      double theta = 2 * M_PI * i / 8;
+      source[2 * i]     = 128 + lround(100 * cos(theta)) + rand() % 5 - 2;
+      source[2 * i + 1] = 128 + lround(100 * sin(theta)) + rand() % 5 - 2;
+    }
+  }
+  if (source.size() == 0) {
+    std::cerr << "no samples to send\n";
+    return 1;
+  }
+
+  // lay out and map the ring
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  uint32_t metaOffset = page;
+  uint32_t dataOffset = (metaOffset + NUM_META * sizeof(rtlsdr_shm_meta_t) + page - 1) / page * page;
+  size_t total = dataOffset + dataBytes;
+  int ringFD = makeRing(total);
+  if (ringFD < 0) {
+    std::cerr << "can't create ring\n";
+    return 1;
+  }
+  char * base = (char *) mmap(0, total, PROT_READ | PROT_WRITE, MAP_SHARED, ringFD, 0);
+  if (base == MAP_FAILED) {
+    std::cerr << "can't map ring\n";
+    return 1;
+  }
+  rtlsdr_shm_hdr_t * hdr = (rtlsdr_shm_hdr_t *) base;
+  rtlsdr_shm_meta_t * meta = (rtlsdr_shm_meta_t *) (base + metaOffset);
+  unsigned char * data = (unsigned char *) base + dataOffset;
+  hdr->rate = rate;
+  hdr->dataBytes = dataBytes;
+  hdr->dataOffset = dataOffset;
+  hdr->numMeta = NUM_META;
+  hdr->metaOffset = metaOffset;
+  hdr->writeBytes = 0;
+  hdr->writeMeta = 0;
+  hdr->version = RTLSDR_SHM_VERSION;
+  __atomic_store_n(& hdr->magic, RTLSDR_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  // listen for clients
+
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  struct sockaddr_un addr;
+  memset(& addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+  unlink(path);
+  if (listener < 0 || bind(listener, (struct sockaddr *) & addr, sizeof(addr)) || listen(listener, 8)) {
+    std::cerr << "can't listen on " << path << "\n";
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector < Client > clients;
+  uint32_t chunkBytes = 2 * (rate / CHUNKS_PER_SECOND);
+  size_t srcPos = 0;
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, & next);
+
+  for (;;) {
+    // write a chunk, then tell every client
+
+    uint64_t w = hdr->writeBytes;
+    double ts = realNow();
+    for (uint32_t done = 0; done < chunkBytes; ) {
+      uint32_t off = (w + done) & (dataBytes - 1);
+      uint32_t n = std::min(std::min(chunkBytes - done, dataBytes - off), (uint32_t) (source.size() - srcPos));
+      memcpy(data + off, & source[srcPos], n);
+      done += n;
+      srcPos = (srcPos + n) % source.size();
+    }
+    uint64_t m = hdr->writeMeta;
+    meta[m & (NUM_META - 1)].byteIndex = w;
+    meta[m & (NUM_META - 1)].ts = ts;
+    __atomic_store_n(& hdr->writeMeta, m + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(& hdr->writeBytes, w + chunkBytes, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    for (size_t i = 0; i < clients.size(); ++i)
+      if (write(clients[i].event, & one, sizeof(one)) < 0 && errno != EAGAIN)
+        std::cerr << "eventfd write failed\n";
+
+    // wait for the next chunk's time, meanwhile accepting and dropping clients
+
+    next.tv_nsec += 1000000000 / CHUNKS_PER_SECOND;
+    if (next.tv_nsec >= 1000000000) {
+      next.tv_nsec -= 1000000000;
+      ++ next.tv_sec;
+    }
+    for (;;) {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, & now);
+      long ms = (next.tv_sec - now.tv_sec) * 1000 + (next.tv_nsec - now.tv_nsec) / 1000000;
+      if (ms <= 0)
+        break;
+      std::vector < struct pollfd > fds(1 + clients.size());
+      fds[0].fd = listener;
+      fds[0].events = POLLIN;
+      for (size_t i = 0; i < clients.size(); ++i) {
+        fds[i + 1].fd = clients[i].sock;
+        fds[i + 1].events = POLLIN;
+      }
+      if (poll(& fds[0], fds.size(), ms) <= 0)
+        continue;
+      for (size_t i = clients.size(); i > 0; --i) {
+        if (fds[i].revents) {
+          // any input or hangup from a client means it's gone
+          close(clients[i - 1].sock);
+          close(clients[i - 1].event);
+          clients.erase(clients.begin() + (i - 1));
+          std::cerr << "client left; " << clients.size() << " remain\n";
+        }
+      }
+      if (fds[0].revents & POLLIN) {
+        Client c;
+        c.sock = accept(listener, 0, 0);
+        if (c.sock < 0)
+          continue;
+        c.event = eventfd(0, EFD_NONBLOCK);
+        if (c.event < 0 || ! sendFDs(c.sock, ringFD, c.event)) {
+          close(c.sock);
+          if (c.event >= 0)
+            close(c.event);
+          continue;
+        }
+        clients.push_back(c);
+        std::cerr << "client joined; " << clients.size() << " connected\n";
+      }
+    }
+  }
+  return 0;
+}
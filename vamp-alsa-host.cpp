@@ -86,8 +86,9 @@
    + funcubedongle), timestamp precision appears to be around 1ms or
    less.
 
-   FIXME:
-   Sample format is hard-coded as S16_LE to match the funcubedongle.
+   The sample format is negotiated with each device: S16_LE (as the
+   funcubedongle delivers) is used as it is, and wider formats are
+   carried as S32_LE.
 
  */
 
@@ -136,6 +137,10 @@ using Vamp::HostExt::PluginInputDomainAdapter;
 #include "Pollable.hpp"
 #include "VampAlsaHost.hpp"
 #include "TCPListener.hpp"
+#include "DevMinder.hpp"
+#include "PluginWorkerPool.hpp"
+#include "RTSched.hpp"
+#include "SweepTimer.hpp"
 
 static VampAlsaHost *host;
 
@@ -162,7 +167,7 @@ usage(string name) {
         "which is licensed under GNU GPL V2.0\n"
          << name << " is freely redistributable under GNU GPL V2.0 or later\n\n"
 
-        "Usage:\n" << name << " [-q] [-s SOCKNAME] &\n"
+        "Usage:\n" << name << " [-q] [-t] [-w NUM_WORKERS] [-r PRIO] [-a CPU_LIST] [-l] [-z] [-b MS] [-s SOCKNAME] &\n"
         "    -- Runs a server which listens and replies to commands via\n"
         "       unix domain socket SOCKNAME, which is created in /tmp\n"
         "       SOCKNAME defaults to " << serverSocketName << std::endl <<
@@ -170,6 +175,34 @@ usage(string name) {
 
         "    Specifying '-q' tells the server not to print the welcome message to clients.\n\n"
 
+        "    Specifying '-t' tells the server to read each started device on its own\n"
+        "    capture thread, so that slow plugins or file writes on the main thread\n"
+        "    don't delay reading from other devices.\n\n"
+
+        "    Specifying '-w NUM_WORKERS' runs plugins on a pool of NUM_WORKERS threads\n"
+        "    instead of on the main thread; e.g. use the number of CPU cores.\n"
+        "    Each plugin still sees its blocks in order, and its output is sent\n"
+        "    in timestamp order.\n\n"
+
+        "    Specifying '-r PRIO' runs the poll and capture threads with SCHED_FIFO\n"
+        "    priority PRIO (1-99), and plugin worker threads one level lower.\n\n"
+
+        "    Specifying '-a CPU_LIST' restricts those threads to the given CPUs,\n"
+        "    e.g. '-a 2,3' or '-a 1-3'.\n\n"
+
+        "    Specifying '-l' locks all memory of the process into RAM and pre-faults\n"
+        "    sample, plugin, and output buffers as they are allocated.\n"
+        "    Use the 'realtime' command to see whether these settings took effect.\n\n"
+
+        "    Specifying '-z' processes frames straight from each audio device's mmap buffer,\n"
+        "    handing them back only once all plugins and listeners are done, rather than\n"
+        "    copying them out first.  Devices read by capture threads ('-t') still copy.\n\n"
+
+        "    Specifying '-b MS' (10 to 100) stops devices from waking the server each period;\n"
+        "    instead, every MS milliseconds, all devices are read in one pass.  With many\n"
+        "    devices, this saves many wakeups, at the cost of up to MS ms more latency.\n"
+        "    Devices read by capture threads ('-t') still wake their own thread.\n\n"
+
         "    The server accepts the following commands on SOCKNAME:\n\n"
          << VampAlsaHost::commandHelp;
 }
@@ -192,20 +225,36 @@ main(int argc, char **argv)
     enum {
         COMMAND_HELP = 'h',
         COMMAND_SOCKET_NAME = 's',
-        COMMAND_QUIET = 'q'
+        COMMAND_QUIET = 'q',
+        COMMAND_CAPTURE_THREADS = 't',
+        COMMAND_PLUGIN_WORKERS = 'w',
+        COMMAND_RT_PRIORITY = 'r',
+        COMMAND_CPUS = 'a',
+        COMMAND_LOCK_MEMORY = 'l',
+        COMMAND_ZERO_COPY = 'z',
+        COMMAND_SWEEP = 'b'
   };
 
     int option_index;
-    static const char short_options[] = "hs:q";
+    static const char short_options[] = "hs:qtw:r:a:lzb:";
     static const struct option long_options[] = {
         {"help", 0, 0, COMMAND_HELP},
         {"socket", 1, 0, COMMAND_SOCKET_NAME},
         {"quiet", 0, 0, COMMAND_QUIET},
+        {"captureThreads", 0, 0, COMMAND_CAPTURE_THREADS},
+        {"pluginWorkers", 1, 0, COMMAND_PLUGIN_WORKERS},
+        {"rtPriority", 1, 0, COMMAND_RT_PRIORITY},
+        {"cpus", 1, 0, COMMAND_CPUS},
+        {"lockMemory", 0, 0, COMMAND_LOCK_MEMORY},
+        {"zeroCopy", 0, 0, COMMAND_ZERO_COPY},
+        {"batchReads", 1, 0, COMMAND_SWEEP},
         {0, 0, 0, 0}
     };
 
     int c;
     bool quiet = false;
+    bool lockMemory = false;
+    int sweepMS = 0;
 
     while ((c = getopt_long(argc, argv, short_options, long_options, &option_index)) != -1) {
         switch (c) {
@@ -226,12 +275,52 @@ main(int argc, char **argv)
         case COMMAND_QUIET:
             quiet = true;
             break;
+        case COMMAND_CAPTURE_THREADS:
+            DevMinder::useCaptureThreads = true;
+            break;
+        case COMMAND_PLUGIN_WORKERS:
+            PluginWorkerPool::start(atoi(optarg));
+            break;
+        case COMMAND_RT_PRIORITY:
+            if (! RTSched::setPriority(atoi(optarg))) {
+                std::cerr << "error: invalid SCHED_FIFO priority '" << optarg << "'\n";
+                exit(1);
+            }
+            break;
+        case COMMAND_CPUS:
+            if (! RTSched::setCPUs(optarg)) {
+                std::cerr << "error: invalid CPU list '" << optarg << "'\n";
+                exit(1);
+            }
+            break;
+        case COMMAND_LOCK_MEMORY:
+            lockMemory = true;
+            break;
+        case COMMAND_ZERO_COPY:
+            DevMinder::useZeroCopy = true;
+            break;
+        case COMMAND_SWEEP:
+            sweepMS = atoi(optarg);
+            if (sweepMS < SweepTimer::MIN_INTERVAL_MS || sweepMS > SweepTimer::MAX_INTERVAL_MS) {
+                std::cerr << "error: batch read interval must be between " << SweepTimer::MIN_INTERVAL_MS
+                          << " and " << SweepTimer::MAX_INTERVAL_MS << " ms\n";
+                exit(1);
+            }
+            break;
         default:
             usage(appname);
             exit(1);
         }
     }
 
+    // real-time settings; failures are reported by the 'realtime' command,
+    // and any worker threads started above get the settings now too
+
+    if (lockMemory && ! RTSched::lockMemory())
+        std::cerr << "warning: unable to lock memory\n";
+    RTSched::addThread("poll", pthread_self(), false);
+    RTSched::applyAll();
+
     // remove existing socket from filespace, with safeguards
 
     struct stat sock_info;
@@ -263,6 +352,8 @@ main(int argc, char **argv)
     label << serverSocketName;
     host = new VampAlsaHost();
     new TCPListener(serverSocketName, label.str(), quiet);
+    if (sweepMS > 0)
+        new SweepTimer("SweepTimer", sweepMS);
     int rv = 0;
     try {
         rv = host->run();